@@ -0,0 +1,188 @@
+#ifndef FROZENREDBLACKTREE_H
+#define FROZENREDBLACKTREE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <utility>
+#include "RedBlackTree.h"
+
+template< typename T, typename Compare = std::less<T> >
+class FrozenRedBlackTree {
+public:
+	//type definitions
+	typedef T value_type;
+	typedef Compare key_compare;
+
+	//constructor
+	FrozenRedBlackTree() : data(NULL), count(0) {}
+
+	//values of a sorted range are stored in Eytzinger (breadth-first) order: the children of position k are 2k and 2k + 1
+	template <typename ForwardIt, typename = typename std::iterator_traits<ForwardIt>::iterator_category>
+	FrozenRedBlackTree(ForwardIt first, ForwardIt last, const key_compare& compare = key_compare()) : data(NULL), count(0), comp(compare) {
+		count = std::distance(first, last);
+		data = allocate(count);
+		size_t k = leftmost(1);
+		for (; first != last; ++first) {
+			new (data + k) T(*first);
+			k = next(k);
+		}
+	}
+
+	FrozenRedBlackTree(const FrozenRedBlackTree& that) : data(allocate(that.count)), count(that.count), comp(that.comp) {
+		for (size_t k = 1; k <= count; k++) {
+			new (data + k) T(that.data[k]);
+		}
+	}
+
+	FrozenRedBlackTree(FrozenRedBlackTree&& that) : data(that.data), count(that.count), comp(that.comp) {
+		that.data = NULL;
+		that.count = 0;
+	}
+
+	FrozenRedBlackTree& operator=(FrozenRedBlackTree that) {
+		std::swap(data, that.data);
+		std::swap(count, that.count);
+		std::swap(comp, that.comp);
+		return *this;
+	}
+
+	~FrozenRedBlackTree() {
+		for (size_t k = 1; k <= count; k++) {
+			data[k].~T();
+		}
+		if (data != NULL) {
+			::operator delete(data, std::align_val_t(cacheLine));
+		}
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	key_compare key_comp() const {
+		return comp;
+	}
+
+	template <typename K>
+	const value_type* find(const K& key) const {
+		//returns pointer to a value equal to key (NULL if there is none)
+		const value_type* found = lower_bound(key);
+		return (found != NULL && !lessThan(key, *found)) ? found : NULL;
+	}
+
+	template <typename K>
+	const value_type* lower_bound(const K& key) const {
+		//returns pointer to the first value >= key (NULL if there is none)
+		return at(search(key, std::false_type()));
+	}
+
+	template <typename K>
+	const value_type* upper_bound(const K& key) const {
+		//returns pointer to the first value > key (NULL if there is none)
+		return at(search(key, std::true_type()));
+	}
+
+	template <typename Visitor>
+	void for_each(Visitor visitor) const {
+		//calls visitor(value) for all values in order
+		for (size_t k = leftmost(1); k != 0; k = next(k)) {
+			visitor(data[k]);
+		}
+	}
+
+private:
+
+	static const size_t cacheLine = 64;
+
+	static constexpr size_t lineValuesHelp(size_t values) {
+		return (values * 2 * sizeof(T) <= cacheLine) ? lineValuesHelp(values * 2) : values;
+	}
+
+	//values that fit in a cache line (a power of two), the same number of positions d levels below k are consecutive
+	static const size_t lineValues = lineValuesHelp(1);
+
+	T* data;
+	size_t count;
+	key_compare comp;
+
+	static T* allocate(size_t count) {
+		//position 0 is unused and the storage is aligned to a cache line, so when sizeof(T) is a power of two
+		//the lineValues descendants of k fill exactly one cache line, other sizes may straddle two lines
+		return (count == 0) ? NULL : static_cast<T*>(::operator new((count + 1) * sizeof(T), std::align_val_t(cacheLine)));
+	}
+
+	static int trailingOnes(size_t k) {
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(~(unsigned long long)k);
+#else
+		int ones = 0;
+		for (; k & 1; k >>= 1) {
+			ones++;
+		}
+		return ones;
+#endif
+	}
+
+	size_t leftmost(size_t k) const {
+		if (k > count) {
+			return 0;
+		}
+		while (2 * k <= count) {
+			k = 2 * k;
+		}
+		return k;
+	}
+
+	size_t next(size_t k) const {
+		//in-order successor: the leftmost position of the right subtree, or the parent after the last left turn
+		if (2 * k + 1 <= count) {
+			return leftmost(2 * k + 1);
+		}
+		return k >> (trailingOnes(k) + 1);
+	}
+
+	const value_type* at(size_t k) const {
+		return (k == 0) ? NULL : data + k;
+	}
+
+	template <typename A, typename B>
+	bool lessThan(const A& a, const B& b) const {
+		return lessHelp(a, b, isThreeWay<Compare>());
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::false_type) const {
+		return comp(a, b);
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::true_type) const {
+		return comp(a, b) < 0;
+	}
+
+	template <typename K, bool Upper>
+	size_t search(const K& key, std::integral_constant<bool, Upper>) const {
+		//descend without branches (the comparison is added to the index) and prefetch the descendants a cache line ahead
+		//the result is the position of the last left turn, after it the path went only right
+		size_t k = 1;
+		while (k <= count) {
+			redBlackPrefetch(reinterpret_cast<const void*>(reinterpret_cast<uintptr_t>(data) + k * lineValues * sizeof(T)));
+			k = 2 * k + (Upper ? !lessThan(key, data[k]) : lessThan(data[k], key));
+		}
+		return k >> (trailingOnes(k) + 1);
+	}
+
+};
+
+template <typename T, typename Allocator, typename Augment, typename Compare>
+FrozenRedBlackTree<T, Compare> RedBlackTree<T, Allocator, Augment, Compare>::freeze() const {
+	return FrozenRedBlackTree<T, Compare>(cbegin(), cend(), comp);
+}
+
+#endif
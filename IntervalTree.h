@@ -0,0 +1,149 @@
+#ifndef INTERVALTREE_H
+#define INTERVALTREE_H
+
+#include <vector>
+#include <iostream>
+#include <limits>
+#include "RedBlackTree.h"
+
+template <typename T>
+struct Interval {
+	//closed interval [low, high]
+	T low, high;
+
+	Interval() : low(), high() {}
+	Interval(const T& l, const T& h) : low(l), high(h) {}
+
+	bool operator<(const Interval& that) const {
+		//ordered by start, then by end
+		return (low < that.low) || (!(that.low < low) && high < that.high);
+	}
+
+	bool operator>(const Interval& that) const {
+		return that < *this;
+	}
+
+	bool operator==(const Interval& that) const {
+		return !(low < that.low) && !(that.low < low) && !(high < that.high) && !(that.high < high);
+	}
+
+	bool operator!=(const Interval& that) const {
+		return !(*this == that);
+	}
+};
+
+template <typename T>
+std::ostream& operator<<(std::ostream& stream, const Interval<T>& interval) {
+	return stream << "[" << interval.low << ", " << interval.high << "]";
+}
+
+template <typename T>
+struct IntervalMaxEnd {
+	//maximal end of intervals in a subtree
+	typedef T result_type;
+	static T identity() { return std::numeric_limits<T>::lowest(); }
+	static T combine(const T& a, const T& b) { return (a < b) ? b : a; }
+	static T project(const Interval<T>& interval) { return interval.high; }
+};
+
+
+
+
+template< typename T, typename Allocator = std::allocator<Interval<T> > >
+class IntervalTree {
+public:
+	//type definitions
+	typedef Interval<T> interval_type;
+	typedef RedBlackTree<interval_type, Allocator, Aggregate<IntervalMaxEnd<T> > > treeType;
+	typedef typename treeType::nodeType nodeType;
+	typedef typename treeType::iterator iterator;
+
+	//constructor
+	IntervalTree() {}
+
+	explicit IntervalTree(const Allocator& alloc) : tree(alloc) {}
+
+	bool empty() const {
+		return tree.empty();
+	}
+
+	iterator begin() {
+		return tree.begin();
+	}
+
+	iterator end() {
+		return tree.end();
+	}
+
+	void clear() {
+		tree.clear();
+	}
+
+	void insert(const interval_type& interval) {
+		tree.insert(interval);
+	}
+
+	void insert(const T& low, const T& high) {
+		tree.insert(interval_type(low, high));
+	}
+
+	void erase(const interval_type& interval) {
+		tree.erase(interval);
+	}
+
+	nodeType* find(const interval_type& interval) {
+		return tree.find(interval);
+	}
+
+	template <typename Visitor>
+	void visit_overlaps(const T& low, const T& high, Visitor visitor) const {
+		//call visitor for every interval overlapping [low, high] in order, nothing is allocated
+		visitHelp(tree.root, low, high, visitor);
+	}
+
+	template <typename Visitor>
+	void visit_stab(const T& point, Visitor visitor) const {
+		//call visitor for every interval containing point
+		visitHelp(tree.root, point, point, visitor);
+	}
+
+	std::vector<interval_type> overlaps(const T& low, const T& high) const {
+		//all intervals overlapping [low, high] in O(min(n, k log(n/k))) for k results, O(log n) when k is 0
+		std::vector<interval_type> result;
+		visit_overlaps(low, high, [&result](const interval_type& interval) { result.push_back(interval); });
+		return result;
+	}
+
+	std::vector<interval_type> stab(const T& point) const {
+		//all intervals containing point
+		return overlaps(point, point);
+	}
+
+	void print() {
+		tree.print();
+	}
+
+	treeType tree;
+
+private:
+
+	template <typename Visitor>
+	void visitHelp(nodeType* node, const T& low, const T& high, Visitor& visitor) const {
+		//skip subtrees where all intervals end before low
+		while (node != NULL && !(node->summary < low)) {
+			visitHelp(node->left, low, high, visitor);
+
+			//node and its right subtree start after high
+			if (high < node->value.low) {
+				return;
+			}
+			if (!(node->value.high < low)) {
+				visitor(node->value);
+			}
+			node = node->right;
+		}
+	}
+
+};
+
+#endif
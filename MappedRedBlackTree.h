@@ -0,0 +1,440 @@
+#ifndef MAPPEDREDBLACKTREE_H
+#define MAPPEDREDBLACKTREE_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "RedBlackTree.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define REDBLACKTREE_MMAP 1
+#endif
+
+//an image is a header followed by the nodes in sorted order, so it can be mapped anywhere and iterated as an array
+struct RedBlackImageHeader {
+	char magic[8];
+	uint32_t version;
+	//0x01020304 as written by the saving machine
+	uint32_t byteOrder;
+	uint32_t valueSize;
+	uint32_t nodeSize;
+	uint64_t count;
+	//position of the root (position + 1, 0 for an empty tree)
+	uint32_t root;
+	uint32_t reserved;
+	//of all nodes, see redBlackImageChecksum
+	uint64_t checksum;
+	uint64_t padding[2];
+};
+
+static_assert(sizeof(RedBlackImageHeader) == 64, "the nodes of an image start at a cache line");
+
+static const char redBlackImageMagic[8] = { 'R', 'B', 'T', 'I', 'M', 'A', 'G', 'E' };
+static const uint32_t redBlackImageVersion = 1;
+
+template <typename T>
+struct RedBlackImageNode {
+	//links are positions in the image (position + 1, 0 is NULL), like IndexLinks the colour is the top bit of a link
+	static const uint32_t colorBit = uint32_t(1) << 31;
+
+	T value;
+	uint32_t left;
+	uint32_t right;
+
+	Color getColor() const { return (right & colorBit) ? BLACK : RED; }
+	uint32_t rightLink() const { return right & ~colorBit; }
+};
+
+inline uint64_t redBlackImageChecksum(const void* data, size_t bytes) {
+	//FNV-1a over 8-byte words (and the remaining bytes), fast enough to check a multi-gigabyte image at disk speed
+	const unsigned char* current = static_cast<const unsigned char*>(data);
+	uint64_t hash = 14695981039346656037ull;
+	for (; bytes >= 8; bytes -= 8, current += 8) {
+		uint64_t word;
+		memcpy(&word, current, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (; bytes > 0; bytes--, current++) {
+		hash = (hash ^ *current) * 1099511628211ull;
+	}
+	return hash;
+}
+
+template< typename T, typename Compare = std::less<T> >
+class MappedRedBlackTree {
+	static_assert(std::is_trivially_copyable<T>::value, "images hold the bytes of the values, T must be trivially copyable");
+
+public:
+	//type definitions
+	typedef T value_type;
+	typedef Compare key_compare;
+	typedef RedBlackImageNode<T> nodeType;
+
+	class const_iterator;
+
+	//constructor
+	MappedRedBlackTree() : mapping(NULL), mappedBytes(0), nodes(NULL), count(0), root(0) {}
+
+	//maps the image at path read-only, verify checks the checksum and the links (reads the whole image once)
+	//without verify, lookups follow the links as they are, so only trusted images may be loaded
+	//on errors the tree stays empty
+	explicit MappedRedBlackTree(const std::string& path, bool verify = true, const key_compare& compare = key_compare())
+		: mapping(NULL), mappedBytes(0), nodes(NULL), count(0), root(0), comp(compare) {
+		open(path, verify);
+	}
+
+	MappedRedBlackTree(const MappedRedBlackTree&) = delete;
+	MappedRedBlackTree& operator=(const MappedRedBlackTree&) = delete;
+
+	MappedRedBlackTree(MappedRedBlackTree&& that)
+		: mapping(that.mapping), mappedBytes(that.mappedBytes), nodes(that.nodes), count(that.count), root(that.root), comp(that.comp) {
+		that.forget();
+	}
+
+	MappedRedBlackTree& operator=(MappedRedBlackTree&& that) {
+		if (this != &that) {
+			unmap();
+			mapping = that.mapping;
+			mappedBytes = that.mappedBytes;
+			nodes = that.nodes;
+			count = that.count;
+			root = that.root;
+			comp = that.comp;
+			that.forget();
+		}
+		return *this;
+	}
+
+	~MappedRedBlackTree() {
+		unmap();
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	key_compare key_comp() const {
+		return comp;
+	}
+
+	template <typename K>
+	const value_type* find(const K& key) const {
+		//returns pointer to a value equal to key (NULL if there is none)
+		const value_type* found = lower_bound(key);
+		return (found != NULL && !lessThan(key, *found)) ? found : NULL;
+	}
+
+	template <typename K>
+	const value_type* lower_bound(const K& key) const {
+		//returns pointer to the first value >= key (NULL if there is none), O(log n) through the saved links
+		uint32_t result = 0;
+		for (uint32_t current = root; current != 0;) {
+			const nodeType& node = nodes[current - 1];
+			if (lessThan(node.value, key)) {
+				current = node.rightLink();
+			}
+			else {
+				result = current;
+				current = node.left;
+			}
+		}
+		return (result == 0) ? NULL : &nodes[result - 1].value;
+	}
+
+	template <typename K>
+	const value_type* upper_bound(const K& key) const {
+		//returns pointer to the first value > key (NULL if there is none)
+		uint32_t result = 0;
+		for (uint32_t current = root; current != 0;) {
+			const nodeType& node = nodes[current - 1];
+			if (lessThan(key, node.value)) {
+				result = current;
+				current = node.left;
+			}
+			else {
+				current = node.rightLink();
+			}
+		}
+		return (result == 0) ? NULL : &nodes[result - 1].value;
+	}
+
+	//nodes are stored in order, so iterators walk the image like an array
+	const_iterator begin() const {
+		return const_iterator(nodes);
+	}
+
+	const_iterator end() const {
+		return const_iterator(nodes + count);
+	}
+
+	template <typename Visitor>
+	void for_each(Visitor visitor) const {
+		//calls visitor(value) for all values in order
+		for (size_t i = 0; i < count; i++) {
+			visitor(nodes[i].value);
+		}
+	}
+
+	const nodeType* root_node() const {
+		//NULL for an empty tree, children are found with node(link)
+		return node(root);
+	}
+
+	const nodeType* node(uint32_t link) const {
+		return (link == 0) ? NULL : nodes + (link - 1);
+	}
+
+private:
+
+	void* mapping;
+	size_t mappedBytes;
+	const nodeType* nodes;
+	size_t count;
+	uint32_t root;
+	key_compare comp;
+
+	template <typename A, typename B>
+	bool lessThan(const A& a, const B& b) const {
+		return lessHelp(a, b, isThreeWay<Compare>());
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::false_type) const {
+		return comp(a, b);
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::true_type) const {
+		return comp(a, b) < 0;
+	}
+
+	void forget() {
+		mapping = NULL;
+		mappedBytes = 0;
+		nodes = NULL;
+		count = 0;
+		root = 0;
+	}
+
+	void unmap() {
+#ifdef REDBLACKTREE_MMAP
+		if (mapping != NULL) {
+			munmap(mapping, mappedBytes);
+		}
+#endif
+		forget();
+	}
+
+	static bool validLinks(const nodeType* nodes, size_t count, uint32_t root) {
+		//the checksum can be recomputed for a crafted image, so lookups are safe only if every link stays in the image
+		//and points between the bounds of its subtree (nodes are stored in order), then no search can loop
+		//all nodes have to be reached, so the links describe the same order as the array
+		struct Range {
+			uint32_t link;
+			uint64_t low;
+			uint64_t high;
+		};
+		std::vector<Range> stack(1, Range{ root, 0, (uint64_t)count + 1 });
+		size_t reached = 0;
+		while (!stack.empty()) {
+			Range range = stack.back();
+			stack.pop_back();
+			if (range.link == 0) {
+				continue;
+			}
+			if (range.link <= range.low || range.link >= range.high) {
+				return false;
+			}
+			reached++;
+			const nodeType& node = nodes[range.link - 1];
+			stack.push_back(Range{ node.left, range.low, range.link });
+			stack.push_back(Range{ node.rightLink(), range.link, range.high });
+		}
+		return reached == count;
+	}
+
+	void open(const std::string& path, bool verify) {
+#ifdef REDBLACKTREE_MMAP
+		int file = ::open(path.c_str(), O_RDONLY);
+		if (file < 0) {
+			std::cout << "The image " << path << " can't be opened!" << std::endl;
+			return;
+		}
+		struct stat status;
+		if (fstat(file, &status) != 0 || (size_t)status.st_size < sizeof(RedBlackImageHeader)) {
+			std::cout << "The image " << path << " is too short!" << std::endl;
+			::close(file);
+			return;
+		}
+		//private mapping, pages are shared with the page cache and other processes mapping the same image
+		size_t bytes = (size_t)status.st_size;
+		void* address = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, file, 0);
+		::close(file);
+		if (address == MAP_FAILED) {
+			std::cout << "The image " << path << " can't be mapped!" << std::endl;
+			return;
+		}
+		mapping = address;
+		mappedBytes = bytes;
+
+		const RedBlackImageHeader* header = static_cast<const RedBlackImageHeader*>(address);
+		const char* problem = NULL;
+		if (memcmp(header->magic, redBlackImageMagic, sizeof(redBlackImageMagic)) != 0 || header->version != redBlackImageVersion) {
+			problem = "is not a tree image of this version";
+		}
+		else if (header->byteOrder != 0x01020304 || header->valueSize != sizeof(T) || header->nodeSize != sizeof(nodeType)) {
+			problem = "was saved for another value type or machine";
+		}
+		else if (header->count > (bytes - sizeof(RedBlackImageHeader)) / sizeof(nodeType) || bytes != sizeof(RedBlackImageHeader) + header->count * sizeof(nodeType) || header->root > header->count) {
+			problem = "is truncated";
+		}
+		else if (verify && redBlackImageChecksum(header + 1, bytes - sizeof(RedBlackImageHeader)) != header->checksum) {
+			problem = "is damaged (wrong checksum)";
+		}
+		else if (verify && !validLinks(reinterpret_cast<const nodeType*>(header + 1), (size_t)header->count, header->root)) {
+			problem = "has links outside of the search tree";
+		}
+		if (problem != NULL) {
+			std::cout << "The image " << path << " " << problem << "!" << std::endl;
+			unmap();
+			return;
+		}
+		nodes = reinterpret_cast<const nodeType*>(header + 1);
+		count = (size_t)header->count;
+		root = header->root;
+#else
+		(void)verify;
+		std::cout << "Mapping the image " << path << " needs mmap!" << std::endl;
+#endif
+	}
+
+public:
+
+	class const_iterator {
+	public:
+		typedef std::random_access_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const T* pointer;
+		typedef const T& reference;
+
+		const_iterator() : node(NULL) {}
+		explicit const_iterator(const nodeType* node) : node(node) {}
+
+		const T& operator*() const { return node->value; }
+		const T* operator->() const { return &node->value; }
+		const T& operator[](difference_type n) const { return node[n].value; }
+
+		const_iterator& operator++() { ++node; return *this; }
+		const_iterator operator++(int) { const_iterator result = *this; ++node; return result; }
+		const_iterator& operator--() { --node; return *this; }
+		const_iterator operator--(int) { const_iterator result = *this; --node; return result; }
+		const_iterator& operator+=(difference_type n) { node += n; return *this; }
+		const_iterator& operator-=(difference_type n) { node -= n; return *this; }
+		const_iterator operator+(difference_type n) const { return const_iterator(node + n); }
+		const_iterator operator-(difference_type n) const { return const_iterator(node - n); }
+		difference_type operator-(const const_iterator& that) const { return node - that.node; }
+
+		bool operator==(const const_iterator& that) const { return node == that.node; }
+		bool operator!=(const const_iterator& that) const { return node != that.node; }
+		bool operator<(const const_iterator& that) const { return node < that.node; }
+		bool operator>(const const_iterator& that) const { return node > that.node; }
+		bool operator<=(const const_iterator& that) const { return node <= that.node; }
+		bool operator>=(const const_iterator& that) const { return node >= that.node; }
+
+	private:
+		const nodeType* node;
+	};
+
+};
+
+template <typename Node, typename T>
+uint32_t redBlackImageWrite(const Node* node, RedBlackImageNode<T>* nodes, uint32_t& next) {
+	//writes the subtree of node in order, returns the link to node, recursion depth is the height of the tree
+	if (node == NULL) {
+		return 0;
+	}
+	uint32_t left = redBlackImageWrite(static_cast<const Node*>(node->left), nodes, next);
+	uint32_t link = ++next;
+	uint32_t right = redBlackImageWrite(static_cast<const Node*>(node->right), nodes, next);
+	RedBlackImageNode<T>& image = nodes[link - 1];
+	memcpy(static_cast<void*>(&image.value), static_cast<const void*>(&node->value), sizeof(T));
+	image.left = left;
+	image.right = right | ((node->getColor() == BLACK) ? RedBlackImageNode<T>::colorBit : 0);
+	return link;
+}
+
+template <typename T, typename Allocator, typename Augment, typename Compare>
+bool RedBlackTree<T, Allocator, Augment, Compare>::save(const std::string& path) const {
+	//the image is written to path.tmp through a shared mapping and renamed at the end, so path is never half-written
+	static_assert(std::is_trivially_copyable<T>::value, "images hold the bytes of the values, T must be trivially copyable");
+	typedef RedBlackImageNode<T> imageNode;
+#ifdef REDBLACKTREE_MMAP
+	size_t count = 0;
+	for (const_iterator it = cbegin(); it != cend(); ++it) {
+		count++;
+	}
+	if (count >= imageNode::colorBit) {
+		std::cout << "Images hold less than 2^31 nodes!" << std::endl;
+		return false;
+	}
+
+	std::string temporary = path + ".tmp";
+	int file = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file < 0) {
+		std::cout << "The image " << temporary << " can't be created!" << std::endl;
+		return false;
+	}
+	size_t bytes = sizeof(RedBlackImageHeader) + count * sizeof(imageNode);
+	void* address = (ftruncate(file, (off_t)bytes) == 0) ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+	if (address == MAP_FAILED) {
+		std::cout << "The image " << temporary << " can't be written!" << std::endl;
+		::close(file);
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	RedBlackImageHeader* header = static_cast<RedBlackImageHeader*>(address);
+	imageNode* nodes = reinterpret_cast<imageNode*>(header + 1);
+	uint32_t next = 0;
+	header->root = redBlackImageWrite(static_cast<const nodeType*>(root), nodes, next);
+	memcpy(header->magic, redBlackImageMagic, sizeof(redBlackImageMagic));
+	header->version = redBlackImageVersion;
+	header->byteOrder = 0x01020304;
+	header->valueSize = sizeof(T);
+	header->nodeSize = sizeof(imageNode);
+	header->count = count;
+	header->checksum = redBlackImageChecksum(nodes, count * sizeof(imageNode));
+
+	bool written = msync(address, bytes, MS_SYNC) == 0;
+	munmap(address, bytes);
+	written = (::close(file) == 0) && written;
+	if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+		std::cout << "The image " << path << " can't be written!" << std::endl;
+		std::remove(temporary.c_str());
+		return false;
+	}
+	return true;
+#else
+	std::cout << "Saving the image " << path << " needs mmap!" << std::endl;
+	return false;
+#endif
+}
+
+template <typename T, typename Allocator, typename Augment, typename Compare>
+MappedRedBlackTree<T, Compare> RedBlackTree<T, Allocator, Augment, Compare>::load_mapped(const std::string& path, bool verify, const key_compare& compare) {
+	return MappedRedBlackTree<T, Compare>(path, verify, compare);
+}
+
+#endif
@@ -0,0 +1,470 @@
+#ifndef PERSISTENTREDBLACKTREE_H
+#define PERSISTENTREDBLACKTREE_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+#include "RedBlackTree.h"
+
+template <typename T>
+struct PersistentRedBlackNode {
+	//nodes have no parent, so one node can be shared by many versions of the tree
+	T value;
+	Color color;
+	std::atomic<size_t> references;
+	PersistentRedBlackNode* left;
+	PersistentRedBlackNode* right;
+
+	PersistentRedBlackNode(const T& val) : value(val), color(RED), references(1), left(NULL), right(NULL) {}
+	PersistentRedBlackNode(T&& val) : value(std::move(val)), color(RED), references(1), left(NULL), right(NULL) {}
+};
+
+
+
+
+template< typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T> >
+class PersistentRedBlackTree {
+public:
+	//type definitions
+	typedef PersistentRedBlackNode<T> nodeType;
+	typedef T value_type;
+	typedef Compare key_compare;
+	typedef Allocator allocator_type;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<nodeType> nodeAllocator;
+	typedef std::allocator_traits<nodeAllocator> nodeAllocTraits;
+
+	//constructor
+	PersistentRedBlackTree() : root(NULL), count(0) {}
+
+	explicit PersistentRedBlackTree(const key_compare& compare, const allocator_type& alloc = allocator_type()) : root(NULL), count(0), nodeAlloc(alloc), comp(compare) {}
+
+	//copies share all nodes, so a copy (snapshot) takes O(1)
+	PersistentRedBlackTree(const PersistentRedBlackTree& that) : root(that.root), count(that.count), nodeAlloc(that.nodeAlloc), comp(that.comp) {
+		retain(root);
+	}
+
+	PersistentRedBlackTree(PersistentRedBlackTree&& that) : root(that.root), count(that.count), nodeAlloc(that.nodeAlloc), comp(that.comp) {
+		that.root = NULL;
+		that.count = 0;
+	}
+
+	PersistentRedBlackTree& operator=(PersistentRedBlackTree that) {
+		std::swap(root, that.root);
+		std::swap(count, that.count);
+		std::swap(nodeAlloc, that.nodeAlloc);
+		std::swap(comp, that.comp);
+		return *this;
+	}
+
+	~PersistentRedBlackTree() {
+		release(root);
+	}
+
+	PersistentRedBlackTree snapshot() const {
+		//read-only version in O(1), it never changes and can be read and destroyed by another thread
+		return *this;
+	}
+
+	bool empty() const {
+		return root == NULL;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	key_compare key_comp() const {
+		return comp;
+	}
+
+	void clear() {
+		release(root);
+		root = NULL;
+		count = 0;
+	}
+
+	template <typename K>
+	const value_type* find(const K& key) const {
+		//returns pointer to a value equal to key (NULL if there is none)
+		const value_type* found = lower_bound(key);
+		return (found != NULL && !lessThan(key, *found)) ? found : NULL;
+	}
+
+	template <typename K>
+	const value_type* lower_bound(const K& key) const {
+		//returns pointer to the first value >= key (NULL if there is none)
+		const value_type* result = NULL;
+		for (nodeType* current = root; current != NULL;) {
+			if (lessThan(current->value, key)) {
+				current = current->right;
+			}
+			else {
+				result = &current->value;
+				current = current->left;
+			}
+		}
+		return result;
+	}
+
+	template <typename K>
+	const value_type* upper_bound(const K& key) const {
+		//returns pointer to the first value > key (NULL if there is none)
+		const value_type* result = NULL;
+		for (nodeType* current = root; current != NULL;) {
+			if (lessThan(key, current->value)) {
+				result = &current->value;
+				current = current->left;
+			}
+			else {
+				current = current->right;
+			}
+		}
+		return result;
+	}
+
+	template <typename Visitor>
+	void for_each(Visitor visitor) const {
+		//calls visitor(value) for all values in order
+		forEachHelp(root, visitor);
+	}
+
+	void insert(const value_type& val) {
+		insertHelp(val);
+	}
+
+	void insert(value_type&& val) {
+		insertHelp(std::move(val));
+	}
+
+	size_t erase(const value_type& val) {
+		//returns number of deleted nodes (0 or 1)
+		if (find(val) == NULL) {
+			return 0;
+		}
+
+		//copy the path to the node
+		nodeType* path[maxHeight];
+		size_t depth = 0;
+		nodeType** link = &root;
+		nodeType* node = own(*link);
+		while (lessThan(val, node->value) || lessThan(node->value, val)) {
+			path[depth++] = node;
+			link = lessThan(val, node->value) ? &node->left : &node->right;
+			node = own(*link);
+		}
+
+		//relink instead of swapping values: the successor takes the place (and the color) of node
+		nodeType* child;
+		Color removedColor;
+		if (node->left == NULL || node->right == NULL) {
+			child = (node->left != NULL) ? node->left : node->right;
+			removedColor = node->color;
+			*link = child;
+		}
+		else {
+			size_t nodeDepth = depth;
+			path[depth++] = node;
+			nodeType** successorLink = &node->right;
+			nodeType* successor = own(*successorLink);
+			while (successor->left != NULL) {
+				path[depth++] = successor;
+				successorLink = &successor->left;
+				successor = own(*successorLink);
+			}
+			child = successor->right;
+			*successorLink = child;
+			successor->left = node->left;
+			successor->right = node->right;
+			removedColor = successor->color;
+			successor->color = node->color;
+			*link = successor;
+			path[nodeDepth] = successor;
+		}
+		destroyNode(node);
+		count--;
+
+		if (removedColor == BLACK) {
+			if (child != NULL) {
+				//the only child of a black node is red
+				nodeType* parent = (depth > 0) ? path[depth - 1] : NULL;
+				own(parent == NULL ? root : (parent->left == child ? parent->left : parent->right))->color = BLACK;
+			}
+			else {
+				eraseFix(path, depth);
+			}
+		}
+		return 1;
+	}
+
+	nodeType* root;
+
+private:
+
+	//red-black trees are at most 2 log2(n + 1) high, erase may add one more node to the path
+	static const size_t maxHeight = 2 * 8 * sizeof(size_t) + 2;
+
+	size_t count;
+	nodeAllocator nodeAlloc;
+	key_compare comp;
+
+	template <typename A, typename B>
+	bool lessThan(const A& a, const B& b) const {
+		return lessHelp(a, b, isThreeWay<Compare>());
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::false_type) const {
+		return comp(a, b);
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::true_type) const {
+		return comp(a, b) < 0;
+	}
+
+	template <typename V>
+	nodeType* createNode(V&& val) {
+		nodeType* node = nodeAllocTraits::allocate(nodeAlloc, 1);
+		nodeAllocTraits::construct(nodeAlloc, node, std::forward<V>(val));
+		return node;
+	}
+
+	void destroyNode(nodeType* node) {
+		nodeAllocTraits::destroy(nodeAlloc, node);
+		nodeAllocTraits::deallocate(nodeAlloc, node, 1);
+	}
+
+	static void retain(nodeType* node) {
+		if (node != NULL) {
+			node->references.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	void release(nodeType* node) {
+		//a node is freed with the last version using it, then its children lose one reference
+		//recursion depth is limited by the height of the tree
+		while (node != NULL && node->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			release(node->left);
+			nodeType* right = node->right;
+			destroyNode(node);
+			node = right;
+		}
+	}
+
+	nodeType* own(nodeType*& link) {
+		//copy on write: a node shared with another version is copied before it is changed
+		//only the writer can add references to a node it owns, so a node with one reference stays owned
+		nodeType* node = link;
+		if (node->references.load(std::memory_order_acquire) != 1) {
+			nodeType* copy = createNode(static_cast<const value_type&>(node->value));
+			copy->color = node->color;
+			copy->left = node->left;
+			copy->right = node->right;
+			retain(copy->left);
+			retain(copy->right);
+			release(node);
+			link = copy;
+			node = copy;
+		}
+		return node;
+	}
+
+	static Color getColor(nodeType* node) {
+		return (node == NULL) ? BLACK : node->color;
+	}
+
+	void replaceChild(nodeType* parent, nodeType* node, nodeType* node2) {
+		if (parent == NULL) {
+			root = node2;
+		}
+		else if (parent->left == node) {
+			parent->left = node2;
+		}
+		else {
+			parent->right = node2;
+		}
+	}
+
+	nodeType* leftRotate(nodeType* node, nodeType* parent) {
+		//node and its right child must be owned, returns the new root of the subtree
+		nodeType* pivot = node->right;
+		node->right = pivot->left;
+		pivot->left = node;
+		replaceChild(parent, node, pivot);
+		return pivot;
+	}
+
+	nodeType* rightRotate(nodeType* node, nodeType* parent) {
+		//node and its left child must be owned, returns the new root of the subtree
+		nodeType* pivot = node->left;
+		node->left = pivot->right;
+		pivot->right = node;
+		replaceChild(parent, node, pivot);
+		return pivot;
+	}
+
+	template <typename V>
+	void insertHelp(V&& val) {
+		//copy the path from the root, path[0, depth) are the owned ancestors of the new node
+		nodeType* path[maxHeight];
+		size_t depth = 0;
+		nodeType** link = &root;
+		while (*link != NULL) {
+			nodeType* node = own(*link);
+			path[depth++] = node;
+			link = lessThan(val, node->value) ? &node->left : &node->right;
+		}
+		nodeType* node = createNode(std::forward<V>(val));
+		*link = node;
+		count++;
+		insertFix(node, path, depth);
+	}
+
+	void insertFix(nodeType* node, nodeType** path, size_t depth) {
+		//same cases as RedBlackTree::insertFix, parents are taken from the path
+		while (depth > 0 && path[depth - 1]->color == RED) {
+			//red parent is never the root
+			nodeType* parent = path[depth - 1];
+			nodeType* grandparent = path[depth - 2];
+			nodeType* greatGrandparent = (depth > 2) ? path[depth - 3] : NULL;
+
+			//parent is left child
+			if (parent == grandparent->left) {
+				//uncle is red -> recolour and move up
+				if (getColor(grandparent->right) == RED) {
+					own(grandparent->right)->color = BLACK;
+					parent->color = BLACK;
+					grandparent->color = RED;
+					node = grandparent;
+					depth -= 2;
+					continue;
+				}
+				//left-right case
+				if (node == parent->right) {
+					parent = leftRotate(parent, grandparent);
+				}
+				//left-left case
+				parent->color = BLACK;
+				grandparent->color = RED;
+				rightRotate(grandparent, greatGrandparent);
+			}
+			//parent is right child
+			else {
+				//uncle is red -> recolour and move up
+				if (getColor(grandparent->left) == RED) {
+					own(grandparent->left)->color = BLACK;
+					parent->color = BLACK;
+					grandparent->color = RED;
+					node = grandparent;
+					depth -= 2;
+					continue;
+				}
+				//right-left case
+				if (node == parent->left) {
+					parent = rightRotate(parent, grandparent);
+				}
+				//right-right case
+				parent->color = BLACK;
+				grandparent->color = RED;
+				leftRotate(grandparent, greatGrandparent);
+			}
+			break;
+		}
+		root->color = BLACK;
+	}
+
+	void eraseFix(nodeType** path, size_t depth) {
+		//the removed (NULL) child of path[depth - 1] has one black less than its sibling
+		//same cases as RedBlackTree::eraseFix, every node that is recoloured or rotated is owned first
+		nodeType* node = NULL;
+		while (depth > 0 && getColor(node) == BLACK) {
+			nodeType* parent = path[depth - 1];
+			nodeType* grandparent = (depth > 1) ? path[depth - 2] : NULL;
+
+			//node is left child
+			if (node == parent->left) {
+				nodeType* sibling = own(parent->right);
+				//sibling is red -> rotate, so that node gets a black sibling, sibling is then above parent on the path
+				if (sibling->color == RED) {
+					sibling->color = BLACK;
+					parent->color = RED;
+					grandparent = leftRotate(parent, grandparent);
+					path[depth - 1] = grandparent;
+					path[depth++] = parent;
+					sibling = own(parent->right);
+				}
+				//all childrens of sibling are black -> recolour and move up
+				if (getColor(sibling->left) == BLACK && getColor(sibling->right) == BLACK) {
+					sibling->color = RED;
+					node = parent;
+					depth--;
+				}
+				else {
+					//right-left case
+					if (getColor(sibling->right) == BLACK) {
+						own(sibling->left)->color = BLACK;
+						sibling->color = RED;
+						sibling = rightRotate(sibling, parent);
+					}
+					//right-right case
+					sibling->color = parent->color;
+					parent->color = BLACK;
+					own(sibling->right)->color = BLACK;
+					leftRotate(parent, grandparent);
+					return;
+				}
+			}
+			//node is right child
+			else {
+				nodeType* sibling = own(parent->left);
+				//sibling is red -> rotate, so that node gets a black sibling, sibling is then above parent on the path
+				if (sibling->color == RED) {
+					sibling->color = BLACK;
+					parent->color = RED;
+					grandparent = rightRotate(parent, grandparent);
+					path[depth - 1] = grandparent;
+					path[depth++] = parent;
+					sibling = own(parent->left);
+				}
+				//all childrens of sibling are black -> recolour and move up
+				if (getColor(sibling->left) == BLACK && getColor(sibling->right) == BLACK) {
+					sibling->color = RED;
+					node = parent;
+					depth--;
+				}
+				else {
+					//left-right case
+					if (getColor(sibling->left) == BLACK) {
+						own(sibling->right)->color = BLACK;
+						sibling->color = RED;
+						sibling = leftRotate(sibling, parent);
+					}
+					//left-left case
+					sibling->color = parent->color;
+					parent->color = BLACK;
+					own(sibling->left)->color = BLACK;
+					rightRotate(parent, grandparent);
+					return;
+				}
+			}
+		}
+		//node is owned (it is on the path)
+		if (node != NULL) {
+			node->color = BLACK;
+		}
+	}
+
+	template <typename Visitor>
+	void forEachHelp(nodeType* node, Visitor& visitor) const {
+		//recursion only for left children, right children are visited in the loop
+		while (node != NULL) {
+			forEachHelp(node->left, visitor);
+			visitor(node->value);
+			node = node->right;
+		}
+	}
+
+};
+
+#endif
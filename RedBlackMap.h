@@ -0,0 +1,190 @@
+#ifndef REDBLACKMAP_H
+#define REDBLACKMAP_H
+
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include "RedBlackTree.h"
+
+template <typename K, typename V, typename Compare>
+struct RedBlackMapCompare {
+	//compares pairs by their keys, keys can be compared with pairs directly
+	typedef void is_transparent;
+	Compare comp;
+
+	RedBlackMapCompare() {}
+	RedBlackMapCompare(const Compare& compare) : comp(compare) {}
+
+	template <typename A, typename B>
+	bool operator()(const A& a, const B& b) const {
+		return comp(key(a), key(b));
+	}
+
+	static const K& key(const std::pair<const K, V>& value) {
+		return value.first;
+	}
+
+	template <typename Key>
+	static const Key& key(const Key& key) {
+		return key;
+	}
+};
+
+
+
+
+template< typename K, typename V, typename Compare = std::less<K>, typename Allocator = std::allocator<std::pair<const K, V> > >
+class RedBlackMap {
+public:
+	//type definitions
+	typedef K key_type;
+	typedef V mapped_type;
+	typedef std::pair<const K, V> value_type;
+	typedef Compare key_compare;
+	typedef RedBlackTree<value_type, Allocator, NoAugment, RedBlackMapCompare<K, V, Compare> > treeType;
+	typedef typename treeType::nodeType nodeType;
+	typedef typename treeType::iterator iterator;
+
+	//constructor
+	RedBlackMap() : count(0) {}
+
+	explicit RedBlackMap(const Compare& compare, const Allocator& alloc = Allocator()) : tree(RedBlackMapCompare<K, V, Compare>(compare), alloc), count(0) {}
+
+	bool empty() const {
+		return tree.empty();
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	iterator begin() {
+		return tree.begin();
+	}
+
+	iterator end() {
+		return tree.end();
+	}
+
+	void clear() {
+		tree.clear();
+		count = 0;
+	}
+
+	template <typename... Args>
+	std::pair<iterator, bool> emplace(Args&&... args) {
+		//the node is built first (its key is needed), it is freed again if the key exists
+		nodeType* node = tree.createNode(std::forward<Args>(args)...);
+		nodeType* parent;
+		bool left;
+		nodeType* found = tree.uniquePosition(node->value.first, parent, left);
+		if (found != NULL) {
+			tree.destroyNode(node);
+			return std::make_pair(iterator(found), false);
+		}
+		return std::make_pair(link(node, parent, left), true);
+	}
+
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) {
+		//no node is allocated (and args are not touched) if the key exists
+		nodeType* parent;
+		bool left;
+		nodeType* found = tree.uniquePosition(key, parent, left);
+		if (found != NULL) {
+			return std::make_pair(iterator(found), false);
+		}
+		nodeType* node = tree.createNode(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+		return std::make_pair(link(node, parent, left), true);
+	}
+
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+		nodeType* parent;
+		bool left;
+		nodeType* found = tree.uniquePosition(key, parent, left);
+		if (found != NULL) {
+			return std::make_pair(iterator(found), false);
+		}
+		nodeType* node = tree.createNode(std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+		return std::make_pair(link(node, parent, left), true);
+	}
+
+	std::pair<iterator, bool> insert(const value_type& value) {
+		return try_emplace(value.first, value.second);
+	}
+
+	std::pair<iterator, bool> insert(value_type&& value) {
+		return emplace(std::move(value));
+	}
+
+	V& operator[](const K& key) {
+		return try_emplace(key).first->second;
+	}
+
+	V& operator[](K&& key) {
+		return try_emplace(std::move(key)).first->second;
+	}
+
+	V& at(const K& key) {
+		nodeType* found = tree.find(key);
+		if (found == NULL) {
+			throw std::out_of_range("RedBlackMap::at - key not found");
+		}
+		return found->value.second;
+	}
+
+	iterator find(const K& key) {
+		nodeType* found = tree.find(key);
+		return (found != NULL) ? iterator(found) : end();
+	}
+
+	size_t erase(const K& key) {
+		//returns number of deleted nodes (0 or 1), the payload is never copied
+		nodeType* found = tree.find(key);
+		if (found == NULL) {
+			return 0;
+		}
+		tree.eraseHelp(found);
+		count--;
+		return 1;
+	}
+
+	iterator erase(iterator pos) {
+		//returns iterator to the next node
+		count--;
+		return tree.erase(pos);
+	}
+
+	iterator erase(iterator first, iterator last) {
+		while (first != last) {
+			first = erase(first);
+		}
+		return last;
+	}
+
+	iterator lower_bound(const K& key) {
+		return tree.lower_bound(key);
+	}
+
+	iterator upper_bound(const K& key) {
+		return tree.upper_bound(key);
+	}
+
+	treeType tree;
+
+private:
+
+	size_t count;
+
+	iterator link(nodeType* node, nodeType* parent, bool left) {
+		tree.linkNode(node, parent, left);
+		tree.insertFix(node);
+		count++;
+		return iterator(node);
+	}
+
+};
+
+#endif
@@ -1,139 +1,670 @@
 #ifndef REDBLACKTREE_H
 #define REDBLACKTREE_H
 
+#include <algorithm>
 #include <iterator>
 #include <string>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+#include <limits>
+#include <utility>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include <new>
+#include <chrono>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
 using std::iterator;
 using std::bidirectional_iterator_tag;
 
 enum Color { RED, BLACK };
 
-template <typename T>
-struct RedBlackNode {
+//augmentations store extra data in every node, update() recomputes it from the children
+struct NoAugment {
+	static const bool augmented = false;
 
-	typedef typename T value_type;
-	value_type value;
-	Color color;
-	RedBlackNode* parent, * left, * right;
+	template <typename Node>
+	static void update(Node*) {}
+};
+
+struct OrderStatistics {
+	static const bool augmented = true;
+	size_t size;
 
-	RedBlackNode(value_type val) : value(val), color(RED), parent(NULL), left(NULL), right(NULL) {}
+	OrderStatistics() : size(1) {}
 
-	value_type& operator=(const RedBlackNode& node) {
-		value = node.val;
-		color = node.color;
-		parent = node.parent;
-		left = node.left;
-		right = node.right;
+	template <typename Node>
+	static void update(Node* node) {
+		//number of nodes in the subtree of node
+		node->size = 1 + ((node->left != NULL) ? node->left->size : 0) + ((node->right != NULL) ? node->right->size : 0);
 	}
+};
 
-	RedBlackNode* max() {
-		if (right == NULL) {
-			return this;
+template <typename Monoid>
+struct Aggregate {
+	//Monoid provides result_type, identity(), combine(a, b) and project(value)
+	static const bool augmented = true;
+	typedef Monoid monoid_type;
+	typedef typename Monoid::result_type summary_type;
+	summary_type summary;
+
+	Aggregate() : summary(Monoid::identity()) {}
+
+	template <typename Node>
+	static void update(Node* node) {
+		//combination of all values in the subtree of node (in order)
+		//(casts select this summary if the node has more aggregates)
+		summary_type result = Monoid::project(node->value);
+		if (node->left != NULL) {
+			result = Monoid::combine(static_cast<Aggregate*>(node->left)->summary, result);
 		}
-		else {
-			return right->max();
+		if (node->right != NULL) {
+			result = Monoid::combine(result, static_cast<Aggregate*>(node->right)->summary);
 		}
+		static_cast<Aggregate*>(node)->summary = result;
 	}
+};
 
-	RedBlackNode* min() {
-		if (left == NULL) {
-			return this;
+template <typename Augment1, typename Augment2>
+struct Augments : public Augment1, public Augment2 {
+	//use two augmentations at once (they can be nested for more)
+	static const bool augmented = Augment1::augmented || Augment2::augmented;
+
+	template <typename Node>
+	static void update(Node* node) {
+		Augment1::update(node);
+		Augment2::update(node);
+	}
+};
+
+template <typename T>
+struct SumMonoid {
+	typedef T result_type;
+	static T identity() { return T(); }
+	static T combine(const T& a, const T& b) { return a + b; }
+	static T project(const T& value) { return value; }
+};
+
+template <typename T>
+struct MinMonoid {
+	typedef T result_type;
+	static T identity() { return std::numeric_limits<T>::max(); }
+	static T combine(const T& a, const T& b) { return (b < a) ? b : a; }
+	static T project(const T& value) { return value; }
+};
+
+template <typename T>
+struct MaxMonoid {
+	typedef T result_type;
+	static T identity() { return std::numeric_limits<T>::lowest(); }
+	static T combine(const T& a, const T& b) { return (a < b) ? b : a; }
+	static T project(const T& value) { return value; }
+};
+
+//node layouts, used like augmentations: RedBlackTree<T, Allocator, CompactColor> or Augments<IndexLinks, OrderStatistics>
+struct CompactColor {
+	//colour stored in the lowest bit of the parent pointer
+	static const bool augmented = false;
+
+	template <typename Node>
+	static void update(Node*) {}
+};
+
+struct IndexLinks {
+	//32-bit links to nodes in RedBlackIndexArena, colour stored in the highest bit of the parent index
+	static const bool augmented = false;
+
+	template <typename Node>
+	static void update(Node*) {}
+};
+
+enum NodeLayout { POINTER_LAYOUT, COMPACT_LAYOUT, INDEX_LAYOUT };
+
+template <typename Augment>
+struct RedBlackLayout : std::integral_constant<NodeLayout,
+	std::is_base_of<IndexLinks, Augment>::value ? INDEX_LAYOUT :
+	std::is_base_of<CompactColor, Augment>::value ? COMPACT_LAYOUT : POINTER_LAYOUT> {};
+
+//statistics, selected like a node layout: RedBlackTree<T, Allocator, Instrumented> or Augments<Instrumented, OrderStatistics>
+struct Instrumented {
+	//the tree counts rotations, recolours, comparisons and allocations and times its operations, see RedBlackTree::stats()
+	static const bool augmented = false;
+
+	template <typename Node>
+	static void update(Node*) {}
+};
+
+enum RedBlackOperation { FIND_OPERATION, INSERT_OPERATION, ERASE_OPERATION };
+
+struct RedBlackStats {
+	static const int operationCount = 3;
+	//bucket i counts operations that took [2^i, 2^(i+1)) nanoseconds (the first one also 0, the last one anything longer)
+	static const int latencyBuckets = 32;
+	//reading the clock stops the overlapping of cache misses of consecutive operations, so only every 16th operation of a kind is timed
+	static const size_t latencySampling = 16;
+
+	size_t left_rotations = 0;
+	size_t right_rotations = 0;
+	size_t recolors = 0;
+	size_t comparisons = 0;
+	size_t allocations = 0;
+	size_t deallocations = 0;
+	//indexed by RedBlackOperation, comparisons of an operation divided by its count give comparisons per operation
+	size_t operations[operationCount] = {};
+	size_t operation_comparisons[operationCount] = {};
+	size_t latency[operationCount][latencyBuckets] = {};
+	//measured when the stats are taken
+	int height = 0;
+	int black_height = 0;
+
+	static const char* operation_name(int operation) {
+		static const char* const names[operationCount] = { "find", "insert", "erase" };
+		return names[operation];
+	}
+
+	std::string to_json() const {
+		std::string json = "{";
+		json += "\"left_rotations\":" + std::to_string(left_rotations);
+		json += ",\"right_rotations\":" + std::to_string(right_rotations);
+		json += ",\"recolors\":" + std::to_string(recolors);
+		json += ",\"comparisons\":" + std::to_string(comparisons);
+		json += ",\"allocations\":" + std::to_string(allocations);
+		json += ",\"deallocations\":" + std::to_string(deallocations);
+		json += ",\"height\":" + std::to_string(height);
+		json += ",\"black_height\":" + std::to_string(black_height);
+		json += ",\"latency_sampling\":" + std::to_string(latencySampling);
+		json += ",\"operations\":{";
+		for (int operation = 0; operation < operationCount; operation++) {
+			json += std::string((operation > 0) ? "," : "") + "\"" + operation_name(operation) + "\":{";
+			json += "\"count\":" + std::to_string(operations[operation]);
+			json += ",\"comparisons\":" + std::to_string(operation_comparisons[operation]);
+			//the histogram is cut after the last non-empty bucket
+			int last = latencyBuckets;
+			while (last > 0 && latency[operation][last - 1] == 0) {
+				last--;
+			}
+			json += ",\"latency_ns_log2\":[";
+			for (int bucket = 0; bucket < last; bucket++) {
+				json += std::string((bucket > 0) ? "," : "") + std::to_string(latency[operation][bucket]);
+			}
+			json += "]}";
 		}
-		else {
-			return left->min();
+		json += "}}";
+		return json;
+	}
+};
+
+template <bool Enabled>
+struct RedBlackStatsCollector {
+	//without Instrumented all calls are empty and compile to nothing
+	static const bool enabled = false;
+
+	struct Scope {
+		Scope(RedBlackStatsCollector&, RedBlackOperation) {}
+	};
+
+	void rotated(bool) {}
+	void recolored(size_t) {}
+	void compared() {}
+	void allocated() {}
+	void deallocated() {}
+
+	RedBlackStats get() const {
+		return RedBlackStats();
+	}
+
+	void reset() {}
+};
+
+template <>
+struct RedBlackStatsCollector<true> {
+	//counters of one tree, like the tree itself not thread-safe (also not for concurrent finds),
+	//so the parallel algorithms of an instrumented tree run in one thread
+	static const bool enabled = true;
+
+	RedBlackStats counters;
+
+	class Scope {
+	public:
+		//counts one public operation and the comparisons made meanwhile, times a sample of them
+		Scope(RedBlackStatsCollector& collector, RedBlackOperation operation)
+			: counters(collector.counters), operation(operation), comparisons(collector.counters.comparisons),
+			timed(collector.counters.operations[operation] % RedBlackStats::latencySampling == 0) {
+			if (timed) {
+				start = std::chrono::steady_clock::now();
+			}
+		}
+
+		~Scope() {
+			if (timed) {
+				uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+				int bucket = 0;
+				while (ns > 1 && bucket < RedBlackStats::latencyBuckets - 1) {
+					ns >>= 1;
+					bucket++;
+				}
+				counters.latency[operation][bucket]++;
+			}
+			counters.operations[operation]++;
+			counters.operation_comparisons[operation] += counters.comparisons - comparisons;
 		}
+
+	private:
+		RedBlackStats& counters;
+		RedBlackOperation operation;
+		size_t comparisons;
+		bool timed;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	void rotated(bool left) {
+		(left ? counters.left_rotations : counters.right_rotations)++;
 	}
 
-	RedBlackNode* successor() {
+	void recolored(size_t nodes) {
+		counters.recolors += nodes;
+	}
+
+	void compared() {
+		counters.comparisons++;
+	}
+
+	void allocated() {
+		counters.allocations++;
+	}
 
-		if (right != NULL) {
-			return right->min();
+	void deallocated() {
+		counters.deallocations++;
+	}
+
+	RedBlackStats get() const {
+		return counters;
+	}
+
+	void reset() {
+		counters = RedBlackStats();
+	}
+};
+
+struct RedBlackHeader {
+	//tag for the header node of a tree, which has no value
+};
+
+
+
+
+template <typename Node>
+class RedBlackIndexArena {
+	//all nodes of one type in chunks of at most 2^16 slots, a node is addressed by (chunk << 16 | slot)
+	//chunks are aligned to their size, so the first slot of a chunk (which holds the chunk number) is found from any node address
+	//index 0 (the first slot of the first chunk) is NULL
+	//trees of one node type in different threads share the arena, so allocations take a lock
+	//(chunks never move, so links are followed without it)
+	static const uint32_t slotBits = 16;
+	static const uint32_t slotMask = (uint32_t(1) << slotBits) - 1;
+	static const uint32_t maxChunks = uint32_t(1) << (31 - slotBits);
+
+	static constexpr size_t chunkSize() {
+		//the largest power of two with at most 2^16 slots
+		size_t size = 1;
+		while (size * 2 <= sizeof(Node) << slotBits) {
+			size <<= 1;
 		}
-		else if (parent != NULL && this == parent->left) {
-			return parent;
+		return size;
+	}
+
+	static const uint32_t slotsPerChunk = uint32_t(chunkSize() / sizeof(Node));
+
+	struct State {
+		Node* chunks[maxChunks];
+		uint32_t chunkCount;
+		uint32_t readyCount;
+		uint32_t used;
+		uint32_t freeList;
+		//chunks are carved from blocks of growing size, each block wastes at most one chunk for alignment
+		void* blocks[32];
+		uint32_t blockCount;
+		//nodes allocated and not yet deallocated
+		uint32_t live;
+		std::mutex lock;
+
+		~State() {
+			release();
 		}
-		else {
-			RedBlackNode* s = this;
-			while (true) {
-				s = s->parent;
-				if (s == NULL) {
-					return NULL;
-				}
-				else if (s->parent != NULL && s == s->parent->left) {
-					return s->parent;
-				}
+
+		void release() {
+			for (uint32_t i = 0; i < blockCount; i++) {
+				::operator delete(blocks[i]);
 			}
+			chunkCount = readyCount = used = freeList = blockCount = 0;
+		}
+	};
+
+	static State state;
+
+	static void addChunks() {
+		uint32_t count = (state.readyCount == 0) ? 1 : state.readyCount;
+		if (count > maxChunks - state.readyCount) {
+			count = maxChunks - state.readyCount;
+		}
+		if (count == 0) {
+			throw std::bad_alloc();
+		}
+
+		char* block = static_cast<char*>(::operator new((count + 1) * chunkSize()));
+		state.blocks[state.blockCount++] = block;
+		uintptr_t aligned = (reinterpret_cast<uintptr_t>(block) + chunkSize() - 1) & ~(chunkSize() - 1);
+		for (uint32_t i = 0; i < count; i++) {
+			Node* chunk = reinterpret_cast<Node*>(aligned + i * chunkSize());
+			*reinterpret_cast<uint32_t*>(chunk) = state.readyCount;
+			state.chunks[state.readyCount++] = chunk;
 		}
-		return NULL;
 	}
 
-	RedBlackNode* predecessor() {
+public:
+	static Node* pointer(uint32_t index) {
+		return (index == 0) ? NULL : state.chunks[index >> slotBits] + (index & slotMask);
+	}
 
-		if (left != NULL) {
-			return left->max();
+	static uint32_t index(const Node* node) {
+		if (node == NULL) {
+			return 0;
 		}
-		else if (parent != NULL && this == parent->right) {
-			return parent;
+		const Node* base = reinterpret_cast<const Node*>(reinterpret_cast<uintptr_t>(node) & ~(chunkSize() - 1));
+		return (*reinterpret_cast<const uint32_t*>(base) << slotBits) | uint32_t(node - base);
+	}
+
+	static Node* allocate() {
+		//reuse a freed slot first, then the next slot of the last chunk
+		std::lock_guard<std::mutex> guard(state.lock);
+		state.live++;
+		if (state.freeList != 0) {
+			Node* node = pointer(state.freeList);
+			state.freeList = *reinterpret_cast<uint32_t*>(node);
+			return node;
 		}
-		else {
-			RedBlackNode* s = this;
-			while (true) {
-				s = s->parent;
-				if (s == NULL) {
-					return NULL;
-				}
-				else if (s->parent != NULL && s == s->parent->right) {
-					return s->parent;
-				}
+		if (state.chunkCount == 0 || state.used == slotsPerChunk) {
+			if (state.chunkCount == state.readyCount) {
+				addChunks();
 			}
+			state.chunkCount++;
+			state.used = 1;
 		}
-		return NULL;
+		return state.chunks[state.chunkCount - 1] + state.used++;
+	}
+
+	static void deallocate(Node* node) {
+		std::lock_guard<std::mutex> guard(state.lock);
+		*reinterpret_cast<uint32_t*>(node) = state.freeList;
+		state.freeList = index(node);
+		state.live--;
+	}
+
+	static size_t reserved_bytes() {
+		//memory taken by all chunks
+		std::lock_guard<std::mutex> guard(state.lock);
+		return state.readyCount * chunkSize();
 	}
 
+	static bool shrink() {
+		//gives all chunks back to the system when no node (or tree header) of this type is alive, returns whether it did
+		std::lock_guard<std::mutex> guard(state.lock);
+		if (state.live != 0) {
+			return false;
+		}
+		state.release();
+		return true;
+	}
 };
 
+template <typename Node>
+typename RedBlackIndexArena<Node>::State RedBlackIndexArena<Node>::state;
 
+template <typename Node>
+struct RedBlackIndexLink {
+	//32-bit link that behaves like Node*
+	uint32_t index;
 
+	RedBlackIndexLink() : index(0) {}
+	RedBlackIndexLink(Node* node) : index(RedBlackIndexArena<Node>::index(node)) {}
 
-template< typename T >
+	RedBlackIndexLink& operator=(Node* node) {
+		index = RedBlackIndexArena<Node>::index(node);
+		return *this;
+	}
+
+	operator Node* () const {
+		return RedBlackIndexArena<Node>::pointer(index);
+	}
+
+	Node* operator->() const {
+		return RedBlackIndexArena<Node>::pointer(index);
+	}
+};
+
+
+
+
+//storage of the value, colour and links, the value is a union member (it is not constructed in the header node)
+template <typename Node, typename T, NodeLayout Layout>
+struct RedBlackNodeBase;
+
+template <typename Node, typename T>
+struct RedBlackNodeBase<Node, T, POINTER_LAYOUT> {
+	union {
+		T value;
+	};
+	Color color;
+	Node* parent, * left, * right;
+
+	template <typename... Args>
+	explicit RedBlackNodeBase(Args&&... args) : value(std::forward<Args>(args)...), color(RED), parent(NULL), left(NULL), right(NULL) {}
+
+	explicit RedBlackNodeBase(RedBlackHeader) : color(BLACK), parent(NULL), left(NULL), right(NULL) {}
+
+	~RedBlackNodeBase() {}
+
+	Node* getParent() const { return parent; }
+	void setParent(Node* node) { parent = node; }
+	Color getColor() const { return color; }
+	void setColor(Color c) { color = c; }
+};
+
+template <typename Node, typename T>
+struct RedBlackNodeBase<Node, T, COMPACT_LAYOUT> {
+	union {
+		T value;
+	};
+	uintptr_t parentColor;
+	Node* left, * right;
+
+	template <typename... Args>
+	explicit RedBlackNodeBase(Args&&... args) : value(std::forward<Args>(args)...), parentColor(RED), left(NULL), right(NULL) {}
+
+	explicit RedBlackNodeBase(RedBlackHeader) : parentColor(BLACK), left(NULL), right(NULL) {}
+
+	~RedBlackNodeBase() {}
+
+	Node* getParent() const { return reinterpret_cast<Node*>(parentColor & ~uintptr_t(1)); }
+	void setParent(Node* node) {
+		//nodes hold pointers, so the lowest bit of their addresses is free
+		parentColor = reinterpret_cast<uintptr_t>(node) | (parentColor & 1);
+	}
+	Color getColor() const { return Color(parentColor & 1); }
+	void setColor(Color c) { parentColor = (parentColor & ~uintptr_t(1)) | uintptr_t(c); }
+};
+
+template <typename Node, typename T>
+struct RedBlackNodeBase<Node, T, INDEX_LAYOUT> {
+	union {
+		T value;
+	};
+	uint32_t parentColor;
+	RedBlackIndexLink<Node> left, right;
+
+	static const uint32_t colorBit = uint32_t(1) << 31;
+
+	template <typename... Args>
+	explicit RedBlackNodeBase(Args&&... args) : value(std::forward<Args>(args)...), parentColor(0) {}
+
+	explicit RedBlackNodeBase(RedBlackHeader) : parentColor(colorBit) {}
+
+	~RedBlackNodeBase() {}
+
+	Node* getParent() const { return RedBlackIndexArena<Node>::pointer(parentColor & ~colorBit); }
+	void setParent(Node* node) { parentColor = RedBlackIndexArena<Node>::index(node) | (parentColor & colorBit); }
+	Color getColor() const { return (parentColor & colorBit) ? BLACK : RED; }
+	void setColor(Color c) { parentColor = (parentColor & ~colorBit) | ((c == BLACK) ? colorBit : 0); }
+};
+
+template <typename T, typename Augment = NoAugment>
+struct RedBlackNode : public Augment, public RedBlackNodeBase<RedBlackNode<T, Augment>, T, RedBlackLayout<Augment>::value> {
+
+	typedef T value_type;
+	typedef RedBlackNodeBase<RedBlackNode, T, RedBlackLayout<Augment>::value> base_type;
+	static const bool indexed = (RedBlackLayout<Augment>::value == INDEX_LAYOUT);
+
+	template <typename... Args>
+	explicit RedBlackNode(Args&&... args) : base_type(std::forward<Args>(args)...) {}
+
+	//header of an empty tree: black, no parent, leftmost and rightmost point to itself
+	explicit RedBlackNode(RedBlackHeader tag) : base_type(tag) {
+		this->left = this;
+		this->right = this;
+	}
+
+	//the value is destroyed by the tree (the header has none)
+	~RedBlackNode() {}
+
+	RedBlackNode* max() {
+		RedBlackNode* node = this;
+		while (node->right != NULL) {
+			node = node->right;
+		}
+		return node;
+	}
+
+	RedBlackNode* min() {
+		RedBlackNode* node = this;
+		while (node->left != NULL) {
+			node = node->left;
+		}
+		return node;
+	}
+
+	RedBlackNode* successor() {
+		//the header (node without parent) follows the maximum
+		if (this->right != NULL) {
+			return this->right->min();
+		}
+
+		RedBlackNode* node = this;
+		RedBlackNode* up = this->getParent();
+		while (up->getParent() != NULL && node == up->right) {
+			node = up;
+			up = up->getParent();
+		}
+		return up;
+	}
+
+	RedBlackNode* predecessor() {
+		//the header precedes the minimum and follows the maximum (its right child)
+		if (this->getParent() == NULL) {
+			return this->right;
+		}
+		if (this->left != NULL) {
+			return this->left->max();
+		}
+
+		RedBlackNode* node = this;
+		RedBlackNode* up = this->getParent();
+		while (up->getParent() != NULL && node == up->left) {
+			node = up;
+			up = up->getParent();
+		}
+		return up;
+	}
+
+};
+
+
+
+
+inline void redBlackPrefetch(const void* address) {
+	//hint the CPU to load the cache line of address (no effect on unsupported compilers)
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_prefetch(address);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+	(void)address;
+#endif
+}
+
+
+
+
+template< typename T, typename Augment = NoAugment, bool Constant = false >
 class RedBlackIterator {
 public:
-	RedBlackNode<T>* iterator;
+	RedBlackNode<T, Augment>* iterator;
 
 	using iterator_category = std::bidirectional_iterator_tag;
-	using value_type = typename T;
+	using value_type = T;
 	using difference_type = std::ptrdiff_t;
-	using pointer = typename T*;
-	using reference = typename T&;
+	using pointer = typename std::conditional<Constant, const T*, T*>::type;
+	using reference = typename std::conditional<Constant, const T&, T&>::type;
 
 	RedBlackIterator() : iterator(NULL) { };
-	RedBlackIterator(RedBlackNode<T>* ptr) : iterator(ptr) { }
+	RedBlackIterator(RedBlackNode<T, Augment>* ptr) : iterator(ptr) { }
 	RedBlackIterator(const RedBlackIterator& that) : iterator(that.iterator) { }
 
-	RedBlackIterator operator++() {
+	//iterator converts to const_iterator, not the other way round
+	template <bool C = Constant, typename = typename std::enable_if<C>::type>
+	RedBlackIterator(const RedBlackIterator<T, Augment, false>& that) : iterator(that.iterator) { }
+
+	RedBlackIterator& operator++() {
 		iterator = iterator->successor();
+#ifdef REDBLACKTREE_PREFETCH
+		//the next node is the leftmost node of the right subtree or an ancestor, load the subtree early
+		if (iterator->right != NULL) {
+			redBlackPrefetch(iterator->right);
+		}
+#endif
 		return *this;
 	}
 
 	RedBlackIterator operator++(int) {
 		RedBlackIterator result = *this;
-		iterator = iterator->successor();
+		++*this;
 		return result;
 	}
 
-	RedBlackIterator operator--() {
+	RedBlackIterator& operator--() {
 		iterator = iterator->predecessor();
+#ifdef REDBLACKTREE_PREFETCH
+		if (iterator->left != NULL) {
+			redBlackPrefetch(iterator->left);
+		}
+#endif
 		return *this;
 	}
 
 	RedBlackIterator operator--(int) {
 		RedBlackIterator result = *this;
-		iterator = iterator->predecessor();
+		--*this;
 		return result;
 	}
 
 	RedBlackIterator& operator=(const RedBlackIterator& that) {
-		iterator->value = that;
+		iterator = that.iterator;
 		return *this;
 	}
 
@@ -145,20 +676,42 @@ public:
 		return (iterator != that.iterator);
 	}
 
-	operator RedBlackNode<T>& () {
+	operator RedBlackNode<T, Augment>& () {
 		return *iterator;
 	}
 
-	operator const RedBlackNode<T>& () const {
+	operator const RedBlackNode<T, Augment>& () const {
 		return *iterator;
 	}
 
-	T operator* () {
+	reference operator* () const {
 		return iterator->value;
 	}
 
-	pointer operator->() {
-		return iterator;
+	pointer operator->() const {
+		return &iterator->value;
+	}
+};
+
+
+
+
+struct RedBlackPoolState {
+	//fixed-size blocks are carved from big slabs, freed blocks go to a free list
+	size_t blockSize;
+	size_t blocksPerSlab;
+	std::vector<char*> slabs;
+	size_t slabIndex;
+	size_t slabOffset;
+	void* freeList;
+
+	//a slab holds at least one block, otherwise the first allocation would point into an empty slab
+	RedBlackPoolState(size_t blocks) : blockSize(0), blocksPerSlab((blocks == 0) ? 1 : blocks), slabIndex(0), slabOffset(0), freeList(NULL) {}
+
+	~RedBlackPoolState() {
+		for (size_t i = 0; i < slabs.size(); i++) {
+			::operator delete(slabs[i]);
+		}
 	}
 };
 
@@ -166,280 +719,1225 @@ public:
 
 
 template< typename T >
-class RedBlackTree {
+class RedBlackNodePool {
+	typedef RedBlackPoolState PoolState;
+
+	template <typename U> friend class RedBlackNodePool;
+
+	std::shared_ptr<PoolState> state;
+
 public:
-	//type definitions
-	typedef typename RedBlackNode <T> nodeType;
-	typedef typename T value_type;
-	typedef RedBlackIterator <value_type> iterator;
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	template <typename U>
+	struct rebind {
+		typedef RedBlackNodePool<U> other;
+	};
+
+	explicit RedBlackNodePool(size_t blocksPerSlab = 1024) : state(std::make_shared<PoolState>(blocksPerSlab)) {}
+
+	//rebound copies share the slabs, the block size is fixed by the first allocation
+	template <typename U>
+	RedBlackNodePool(const RedBlackNodePool<U>& that) : state(that.state) {}
+
+	T* allocate(size_t n) {
+		size_t size = (sizeof(T) < sizeof(void*)) ? sizeof(void*) : sizeof(T);
+		if (state->blockSize == 0 && n == 1 && alignof(T) <= alignof(std::max_align_t)) {
+			state->blockSize = size;
+		}
+		if (n != 1 || size != state->blockSize) {
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
 
-	//constructor
-	RedBlackTree() : root(NULL) {}
+		//reuse a freed block first
+		if (state->freeList != NULL) {
+			void* block = state->freeList;
+			state->freeList = *static_cast<void**>(block);
+			return static_cast<T*>(block);
+		}
 
-	//~RedBlackTree() {
-	//	destroyRecursive(root);
-	//}
+		//move to the next slab (allocate a new one if all of them are used)
+		if (state->slabIndex == state->slabs.size() || state->slabOffset + size > size * state->blocksPerSlab) {
+			if (state->slabIndex < state->slabs.size()) {
+				state->slabIndex++;
+			}
+			if (state->slabIndex == state->slabs.size()) {
+				state->slabs.push_back(static_cast<char*>(::operator new(size * state->blocksPerSlab)));
+			}
+			state->slabOffset = 0;
+		}
 
-	//void destroyRecursive(nodeType* node) {
-	//	if (node == NULL) {
-	//		return;
-	//	}
-	//	destroyRecursive(node->left);
-	//	destroyRecursive(node->right);
-	//	delete node;
-	//}
+		char* block = state->slabs[state->slabIndex] + state->slabOffset;
+		state->slabOffset += size;
+		return reinterpret_cast<T*>(block);
+	}
 
-	bool empty() const {
-		return (root == NULL);
+	void deallocate(T* ptr, size_t n) {
+		size_t size = (sizeof(T) < sizeof(void*)) ? sizeof(void*) : sizeof(T);
+		if (n != 1 || size != state->blockSize) {
+			::operator delete(ptr);
+			return;
+		}
+		*reinterpret_cast<void**>(ptr) = state->freeList;
+		state->freeList = ptr;
 	}
 
-	iterator begin() {
-		return min();
+	bool unique() const {
+		return state.use_count() == 1;
 	}
-	iterator end() {
-		return iterator();
+
+	void release() {
+		//all blocks become free at once, slabs are kept for reuse
+		state->slabIndex = 0;
+		state->slabOffset = 0;
+		state->freeList = NULL;
 	}
-	iterator max() {
-		if (empty()) {
-			return end();
-		}
-		else {
-			return iterator(root->max());
-		}
+
+	template <typename U>
+	bool operator==(const RedBlackNodePool<U>& that) const {
+		return state == that.state;
 	}
-	iterator min() {
-		if (empty()) {
-			return end();
-		}
-		else {
-			return iterator(root->min());
-		}
+
+	template <typename U>
+	bool operator!=(const RedBlackNodePool<U>& that) const {
+		return state != that.state;
 	}
+};
 
-	nodeType* find(value_type val) {
 
-		if (empty()) {
-			return NULL;
-		}
 
-		nodeType* found = NULL;
-		nodeType* current = root;
 
-		while (current != NULL) {
-			if (current->value == val) {
-				found = current;
-				break;
-			}
+template <typename Allocator, typename = void>
+struct hasRelease : std::false_type {};
 
-			if (current->value < val) {
-				current = current->right;
-			}
-			else {
-				current = current->left;
-			}
-		}
+template <typename Compare, typename = void>
+struct isThreeWay : std::false_type {};
 
-		return found;
+template <typename Compare>
+struct isThreeWay<Compare, std::void_t<typename Compare::is_three_way> > : std::true_type {};
+
+struct ThreeWayCompare {
+	//transparent comparator returning <0, 0 or >0 (uses compare() of strings)
+	typedef void is_transparent;
+	typedef void is_three_way;
+
+	template <typename A, typename B>
+	int operator()(const A& a, const B& b) const {
+		return compareHelp(a, b, 0);
 	}
 
-	void insert(value_type val) {
-		nodeType* node = new nodeType(val);
-		insertHelp(node);
-		//balancing after insertion
-		insertFix(node);
+private:
+	template <typename A, typename B>
+	static auto compareHelp(const A& a, const B& b, int) -> decltype(a.compare(b), int()) {
+		int result = a.compare(b);
+		return (result < 0) ? -1 : (result > 0);
 	}
 
-	void erase(value_type val) {
+	template <typename A, typename B>
+	static int compareHelp(const A& a, const B& b, long) {
+		return (a < b) ? -1 : (b < a);
+	}
+};
 
-		//find node to delete
-		nodeType* found = find(val);
+template <typename Allocator>
+struct hasRelease<Allocator, decltype(std::declval<Allocator&>().release(), void())> : std::true_type {};
 
-		//delete node if it exists
-		if (found != NULL) {
-			eraseHelp(found);
-		}
+
+
+
+template <typename Node, bool Indexed = Node::indexed>
+struct RedBlackHeaderStorage {
+	//the header of a tree lives in the tree object
+	Node node;
+
+	RedBlackHeaderStorage() : node(RedBlackHeader()) {}
+	RedBlackHeaderStorage(const RedBlackHeaderStorage&) = delete;
+
+	Node* get() {
+		return &node;
+	}
+};
+
+template <typename Node>
+struct RedBlackHeaderStorage<Node, true> {
+	//index links can only point into the arena, so the header is allocated there
+	Node* node;
+
+	RedBlackHeaderStorage() : node(new (RedBlackIndexArena<Node>::allocate()) Node(RedBlackHeader())) {}
+	RedBlackHeaderStorage(const RedBlackHeaderStorage&) = delete;
+
+	~RedBlackHeaderStorage() {
+		node->~Node();
+		RedBlackIndexArena<Node>::deallocate(node);
+	}
+
+	Node* get() {
+		return node;
+	}
+};
+
+
+
+
+template< typename K, typename V, typename Compare, typename Allocator >
+class RedBlackMap;
+
+template< typename T, typename Compare >
+class FrozenRedBlackTree;
+
+template< typename T, typename Compare >
+class MappedRedBlackTree;
+
+template< typename T, typename Allocator = std::allocator<T>, typename Augment = NoAugment, typename Compare = std::less<T> >
+class RedBlackTree {
+	template <typename, typename, typename, typename> friend class RedBlackMap;
+
+public:
+	//type definitions
+	typedef RedBlackNode <T, Augment> nodeType;
+	typedef T value_type;
+	typedef RedBlackIterator <value_type, Augment> iterator;
+	typedef RedBlackIterator <value_type, Augment, true> const_iterator;
+	typedef Allocator allocator_type;
+	typedef Compare key_compare;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<nodeType> nodeAllocator;
+	typedef std::allocator_traits<nodeAllocator> nodeAllocTraits;
+
+	//constructor
+	RedBlackTree() : root(NULL) {}
+
+	explicit RedBlackTree(const allocator_type& alloc) : root(NULL), nodeAlloc(alloc) {}
+
+	explicit RedBlackTree(const key_compare& compare, const allocator_type& alloc = allocator_type()) : root(NULL), nodeAlloc(alloc), comp(compare) {}
+
+	//build the tree from a sorted range in O(n)
+	template <typename ForwardIt, typename = typename std::iterator_traits<ForwardIt>::iterator_category>
+	RedBlackTree(ForwardIt first, ForwardIt last, const allocator_type& alloc = allocator_type()) : root(NULL), nodeAlloc(alloc) {
+		assign(first, last);
+	}
+
+	template <typename ForwardIt, typename = typename std::iterator_traits<ForwardIt>::iterator_category>
+	RedBlackTree(ForwardIt first, ForwardIt last, const key_compare& compare, const allocator_type& alloc = allocator_type()) : root(NULL), nodeAlloc(alloc), comp(compare) {
+		assign(first, last);
+	}
+
+	//copies clone the node structure in O(n), values are copied but never compared
+	RedBlackTree(const RedBlackTree& that) : root(NULL), nodeAlloc(nodeAllocTraits::select_on_container_copy_construction(that.nodeAlloc)), comp(that.comp) {
+		setRoot(cloneHelp(that.root));
+	}
+
+	//the header lives in the tree object, so moving relinks the root and the cached min/max in O(1)
+	//(the allocator is copied, so the moved-from tree stays usable; index links allocate a header in the arena)
+	RedBlackTree(RedBlackTree&& that) noexcept(std::is_nothrow_copy_constructible<nodeAllocator>::value && std::is_nothrow_copy_constructible<Compare>::value && !nodeType::indexed)
+		: root(NULL), nodeAlloc(that.nodeAlloc), comp(that.comp) {
+		take(that);
+	}
+
+	RedBlackTree& operator=(const RedBlackTree& that) {
+		if (this != &that) {
+			clear();
+			comp = that.comp;
+			propagateAllocator(that.nodeAlloc, typename nodeAllocTraits::propagate_on_container_copy_assignment());
+			setRoot(cloneHelp(that.root));
+		}
+		return *this;
+	}
+
+	//the nodes are stolen in O(1) if the allocator propagates (like std::map) or all allocators are equal
+	RedBlackTree& operator=(RedBlackTree&& that) noexcept((nodeAllocTraits::propagate_on_container_move_assignment::value || nodeAllocTraits::is_always_equal::value) && std::is_nothrow_copy_assignable<Compare>::value) {
+		if (this != &that) {
+			clear();
+			comp = that.comp;
+			propagateAllocator(that.nodeAlloc, typename nodeAllocTraits::propagate_on_container_move_assignment());
+			if (nodeAllocTraits::is_always_equal::value || nodeAlloc == that.nodeAlloc) {
+				take(that);
+			}
+			else {
+				//nodes can't be moved between different pools, so they are copied
+				setRoot(cloneHelp(that.root));
+				that.clear();
+			}
+		}
+		return *this;
+	}
+
+	~RedBlackTree() {
+		clear();
+	}
+
+	allocator_type get_allocator() const {
+		return allocator_type(nodeAlloc);
+	}
+
+	key_compare key_comp() const {
+		return comp;
+	}
+
+	void clear() {
+		//deletes all nodes in O(n) without recursion
+		if (!releaseNodes(nodeAlloc)) {
+			destroySubtree(root, false);
+		}
+		setRoot(NULL);
+	}
+
+	template <typename ForwardIt>
+	void assign(ForwardIt first, ForwardIt last) {
+		// we can build the tree without rotations iff the values are sorted
+		if (first != last) {
+			ForwardIt previous = first;
+			for (ForwardIt it = std::next(first); it != last; ++it, ++previous) {
+				if (lessThan(*it, *previous)) {
+					std::cout << "Values should be sorted in ascending order!" << std::endl;
+					return;
+				}
+			}
+		}
+
+		clear();
+
+		//nodes in the last (incomplete) level of the balanced tree are red, all others are black
+		size_t count = std::distance(first, last);
+		int redDepth = 0;
+		while (((size_t(2) << redDepth) - 1) <= count) {
+			redDepth++;
+		}
+
+		setRoot(buildSorted(first, count, 0, redDepth));
+	}
+
+	template <typename ForwardIt>
+	void build_parallel(ForwardIt first, ForwardIt last, unsigned threads = std::thread::hardware_concurrency()) {
+		//replace the content of the tree with an unsorted range: both halves are sorted in parallel and merged,
+		//then subtrees are built in parallel (with stateless allocators) and linked with the same colors as assign
+		std::vector<value_type> values(first, last);
+		int forkDepth = 0;
+		while (!statistics.enabled && (1u << forkDepth) < threads) {
+			forkDepth++;
+		}
+		parallelSort(values.begin(), values.end(), forkDepth);
+
+		clear();
+		int redDepth = 0;
+		while (((size_t(2) << redDepth) - 1) <= values.size()) {
+			redDepth++;
+		}
+		if (!nodeAllocTraits::is_always_equal::value || nodeType::indexed) {
+			forkDepth = 0;
+		}
+		setRoot(buildParallel(std::make_move_iterator(values.begin()), values.size(), 0, redDepth, forkDepth));
+	}
+
+	//read-only copy for lookups in a cache-friendly layout, defined in FrozenRedBlackTree.h
+	FrozenRedBlackTree<T, Compare> freeze() const;
+
+	//binary image of the tree (trivially copyable T), loaded without deserialization, both defined in MappedRedBlackTree.h
+	bool save(const std::string& path) const;
+	static MappedRedBlackTree<T, Compare> load_mapped(const std::string& path, bool verify = true, const key_compare& compare = key_compare());
+
+	bool empty() const {
+		return (root == NULL);
+	}
+
+	//min and max are cached in the header, end() is the header itself (so --end() is the maximum)
+	iterator begin() {
+		return min();
+	}
+	iterator end() {
+		return iterator(header);
+	}
+	iterator max() {
+		return iterator(header->right);
+	}
+	iterator min() {
+		return iterator(header->left);
+	}
+
+	const_iterator begin() const {
+		return const_iterator(header->left);
+	}
+	const_iterator end() const {
+		return const_iterator(const_cast<nodeType*>(header));
+	}
+	const_iterator cbegin() const {
+		return begin();
+	}
+	const_iterator cend() const {
+		return end();
+	}
+
+	template <typename Visitor>
+	void for_each(Visitor visitor) {
+		//call visitor(value) for all nodes in order, faster than iterating
+		forEachHelp(root, visitor);
+	}
+
+	template <typename Visitor>
+	void for_each(const value_type& low, const value_type& high, Visitor visitor) {
+		//call visitor(value) for nodes with low <= value < high in order, O(log n + k)
+		forEachHelp(root, low, high, visitor);
+	}
+
+	void pop_min() {
+		//delete the smallest node in amortized O(1)
+		if (!empty()) {
+			eraseHelp(header->left);
+		}
+	}
+
+	void pop_max() {
+		//delete the largest node in amortized O(1)
+		if (!empty()) {
+			eraseHelp(header->right);
+		}
+	}
+
+	nodeType* find(const value_type& val) {
+		typename decltype(statistics)::Scope scope(statistics, FIND_OPERATION);
+		return findHelp(val);
+	}
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	nodeType* find(const K& key) {
+		//heterogeneous lookup (e.g. std::string tree by std::string_view with std::less<>)
+		typename decltype(statistics)::Scope scope(statistics, FIND_OPERATION);
+		return findHelp(key);
+	}
+
+	iterator lower_bound(const value_type& val) {
+		//first node with value >= val
+		return toIterator(lowerBoundHelp(val));
+	}
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator lower_bound(const K& key) {
+		return toIterator(lowerBoundHelp(key));
+	}
+
+	iterator upper_bound(const value_type& val) {
+		//first node with value > val
+		return toIterator(upperBoundHelp(val));
+	}
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	iterator upper_bound(const K& key) {
+		return toIterator(upperBoundHelp(key));
+	}
+
+	std::pair<iterator, iterator> equal_range(const value_type& val) {
+		//all nodes with value == val
+		return std::make_pair(lower_bound(val), upper_bound(val));
+	}
+
+	template <typename K, typename C = Compare, typename = typename C::is_transparent>
+	std::pair<iterator, iterator> equal_range(const K& key) {
+		return std::make_pair(lower_bound(key), upper_bound(key));
+	}
+
+	//batched lookups advance up to 16 searches in lockstep and prefetch the next node of each one, so their cache misses overlap
+
+	template <typename ForwardIt, typename OutputIt>
+	OutputIt find_batch(ForwardIt first, ForwardIt last, OutputIt out) {
+		//writes find(key) for every key of the range to out
+		return batchHelp(first, last, out, std::true_type());
+	}
+
+	template <typename ForwardIt, typename OutputIt>
+	OutputIt lower_bound_batch(ForwardIt first, ForwardIt last, OutputIt out) {
+		//writes lower_bound(key) for every key of the range to out
+		return batchHelp(first, last, out, std::false_type());
+	}
+
+	//order statistics (Augment = OrderStatistics), all in O(log n)
+
+	size_t size() const {
+		static_assert(std::is_base_of<OrderStatistics, Augment>::value, "size() needs OrderStatistics augmentation");
+		return (root != NULL) ? root->size : 0;
+	}
+
+	iterator select(size_t k) {
+		//k-th smallest node (from 0), end() if k >= size()
+		static_assert(std::is_base_of<OrderStatistics, Augment>::value, "select() needs OrderStatistics augmentation");
+		nodeType* current = root;
+		while (current != NULL) {
+			size_t leftSize = (current->left != NULL) ? current->left->size : 0;
+			if (k < leftSize) {
+				current = current->left;
+			}
+			else if (k == leftSize) {
+				return iterator(current);
+			}
+			else {
+				k -= leftSize + 1;
+				current = current->right;
+			}
+		}
+		return end();
+	}
+
+	size_t rank(const value_type& val) const {
+		//number of nodes with values < val
+		static_assert(std::is_base_of<OrderStatistics, Augment>::value, "rank() needs OrderStatistics augmentation");
+		size_t result = 0;
+		nodeType* current = root;
+		while (current != NULL) {
+			if (lessThan(current->value, val)) {
+				result += ((current->left != NULL) ? current->left->size : 0) + 1;
+				current = current->right;
+			}
+			else {
+				current = current->left;
+			}
+		}
+		return result;
+	}
+
+	size_t count_range(const value_type& low, const value_type& high) const {
+		//number of nodes with low <= value < high
+		if (lessThan(high, low)) {
+			return 0;
+		}
+		return rank(high) - rank(low);
+	}
+
+	template <typename A = Augment>
+	typename A::summary_type aggregate(const value_type& low, const value_type& high) const {
+		//combination of values low <= value < high in O(log n) (needs Aggregate augmentation)
+		//with more aggregates in one tree select one of them: aggregate<Aggregate<Monoid>>(low, high)
+		typedef typename A::monoid_type Monoid;
+		typename A::summary_type leftPart = Monoid::identity();
+		typename A::summary_type rightPart = Monoid::identity();
+
+		//find the highest node in the interval, paths to low and high split there
+		nodeType* split = root;
+		while (split != NULL && (lessThan(split->value, low) || !lessThan(split->value, high))) {
+			split = lessThan(split->value, low) ? split->right : split->left;
+		}
+		if (split == NULL) {
+			return leftPart;
+		}
+
+		//nodes >= low in the left subtree
+		nodeType* current = split->left;
+		while (current != NULL) {
+			if (lessThan(current->value, low)) {
+				current = current->right;
+			}
+			else {
+				if (current->right != NULL) {
+					leftPart = Monoid::combine(static_cast<const A*>(current->right)->summary, leftPart);
+				}
+				leftPart = Monoid::combine(Monoid::project(current->value), leftPart);
+				current = current->left;
+			}
+		}
+
+		//nodes < high in the right subtree
+		current = split->right;
+		while (current != NULL) {
+			if (!lessThan(current->value, high)) {
+				current = current->left;
+			}
+			else {
+				if (current->left != NULL) {
+					rightPart = Monoid::combine(rightPart, static_cast<const A*>(current->left)->summary);
+				}
+				rightPart = Monoid::combine(rightPart, Monoid::project(current->value));
+				current = current->right;
+			}
+		}
+
+		return Monoid::combine(Monoid::combine(leftPart, Monoid::project(split->value)), rightPart);
+	}
+
+	void insert(const value_type& val) {
+		typename decltype(statistics)::Scope scope(statistics, INSERT_OPERATION);
+		nodeType* node = createNode(val);
+		insertHelp(node);
+		//balancing after insertion
+		insertFix(node);
+	}
+
+	void insert(value_type&& val) {
+		typename decltype(statistics)::Scope scope(statistics, INSERT_OPERATION);
+		nodeType* node = createNode(std::move(val));
+		insertHelp(node);
+		insertFix(node);
+	}
+
+	iterator insert(iterator hint, const value_type& val) {
+		//insert as close as possible before hint, amortized O(1) if val belongs right before hint
+		typename decltype(statistics)::Scope scope(statistics, INSERT_OPERATION);
+		nodeType* node = createNode(val);
+		insertHint(node, hint.iterator);
+		insertFix(node);
+		return iterator(node);
+	}
+
+	iterator insert(iterator hint, value_type&& val) {
+		typename decltype(statistics)::Scope scope(statistics, INSERT_OPERATION);
+		nodeType* node = createNode(std::move(val));
+		insertHint(node, hint.iterator);
+		insertFix(node);
+		return iterator(node);
+	}
+
+	template <typename... Args>
+	iterator emplace(Args&&... args) {
+		//construct the value in the new node
+		typename decltype(statistics)::Scope scope(statistics, INSERT_OPERATION);
+		nodeType* node = createNode(std::forward<Args>(args)...);
+		insertHelp(node);
+		insertFix(node);
+		return iterator(node);
+	}
+
+	void erase(const value_type& val) {
+		typename decltype(statistics)::Scope scope(statistics, ERASE_OPERATION);
+
+		//find node to delete
+		nodeType* found = findHelp(val);
+
+		//delete node if it exists
+		if (found != NULL) {
+			eraseHelp(found);
+		}
+	}
+
+	iterator erase(const_iterator pos) {
+		//delete the node at pos in amortized O(1) plus rebalancing, returns iterator to the next node
+		//nodes are relinked, so no value is copied and iterators to other nodes stay valid
+		typename decltype(statistics)::Scope scope(statistics, ERASE_OPERATION);
+		nodeType* node = pos.iterator;
+		nodeType* next = node->successor();
+		eraseHelp(node);
+		return iterator(next);
+	}
+
+	iterator erase(iterator pos) {
+		return erase(const_iterator(pos));
+	}
+
+	iterator erase(const_iterator first, const_iterator last) {
+		//delete nodes in [first, last) in O(log n + k), returns last
+		if (first.iterator == header->left && last.iterator == header) {
+			clear();
+			return end();
+		}
+		while (first != last) {
+			first = erase(first);
+		}
+		return iterator(last.iterator);
+	}
+
+	RedBlackStats stats() const {
+		//counters (zero without Instrumented), height and black height are measured now in O(n)
+		RedBlackStats result = statistics.get();
+		result.height = heightHelp(root);
+		for (const nodeType* node = root; node != NULL; node = node->left) {
+			result.black_height += (node->getColor() == BLACK);
+		}
+		return result;
+	}
+
+	void reset_stats() {
+		statistics.reset();
+	}
+
+	void print() {
+		if (!empty()) {
+			printHelp(this->root, "", true);
+		}
+	}
+
+	void merge(RedBlackTree tree2) {
+		// we can merge trees iff all the nodes belonging to tree1 <= all nodes of tree2 (due to algorithm)
+		if (!empty() && !tree2.empty() && lessThan(tree2.header->left->value, header->right->value)) {
+			std::cout << "All the nodes belonging to tree1 should be less than (in value) all nodes of tree2!" << std::endl;
+			return;
+		}
+		join(std::move(tree2));
+	}
+
+	void join(RedBlackTree&& tree2) {
+		//append all nodes of tree2 (all of them must be >= nodes of this tree), tree2 becomes empty
+		//black heights are measured and the minimum of tree2 unlinked in O(log n + log m), linking takes O(|h1 - h2|)
+		if (&tree2 == this) {
+			std::cout << "A tree can't be joined with itself!" << std::endl;
+			return;
+		}
+		if (tree2.empty()) {
+			return;
+		}
+		if (!empty() && lessThan(tree2.header->left->value, header->right->value)) {
+			std::cout << "All the nodes belonging to tree1 should be less than (in value) all nodes of tree2!" << std::endl;
+			return;
+		}
+		if (nodeAlloc != tree2.nodeAlloc) {
+			//nodes can't be moved between different pools, so they are copied
+			for (iterator it = tree2.begin(); it != tree2.end(); ++it) {
+				insert(*it);
+			}
+			tree2.clear();
+			return;
+		}
+
+		if (empty()) {
+			take(tree2);
+			return;
+		}
+
+		//minimum of tree2 is the node joining both trees
+		nodeType* pivot = tree2.header->left;
+		nodeType* rightmost = tree2.header->right;
+		tree2.unlinkNode(pivot);
+		joinHelp(pivot, blackHeight(root), tree2, blackHeight(tree2.root));
+		header->right = rightmost;
+	}
+
+	std::pair<RedBlackTree, RedBlackTree> split(const value_type& key) {
+		//split the tree to nodes < key and nodes >= key by relinking, this tree becomes empty
+		RedBlackTree less(comp, get_allocator());
+		RedBlackTree greater(comp, get_allocator());
+		nodeType* lessRoot;
+		nodeType* greaterRoot;
+		int heightLess, heightGreater;
+		nodeType* node = root;
+		setRoot(NULL);
+		splitHelp(detach(node), blackHeight(node), key, false, lessRoot, heightLess, greaterRoot, heightGreater);
+		less.setRoot(lessRoot);
+		greater.setRoot(greaterRoot);
+		return std::make_pair(std::move(less), std::move(greater));
+	}
+
+	//set operations compare values only, the nodes of this tree win over equal nodes of tree2
+	//the recursion runs in parallel for subtrees with at least grain nodes, tree2 becomes empty
+
+	void set_union(RedBlackTree&& tree2, size_t grain = 4096) {
+		//keep all nodes of this tree and nodes of tree2 with values not found in this tree
+		setOperation(SET_UNION, tree2, grain);
+	}
+
+	void set_intersection(RedBlackTree&& tree2, size_t grain = 4096) {
+		//keep nodes of this tree with values found in tree2
+		setOperation(SET_INTERSECTION, tree2, grain);
+	}
+
+	void set_difference(RedBlackTree&& tree2, size_t grain = 4096) {
+		//keep nodes of this tree with values not found in tree2
+		setOperation(SET_DIFFERENCE, tree2, grain);
+	}
+
+	//batches are sorted first and applied in one pass: each key is searched from the node of the previous key (finger search),
+	//which climbs only to the first ancestor past the key, O(log d) for d nodes between the two keys (from the root if d is large)
+	//with a grain the sorted batch becomes a tree in O(m), which is combined with this tree by split and join
+	//in O(m log(n/m + 1)), subtrees with at least grain nodes in parallel (like set_union)
+
+	template <typename ForwardIt>
+	void insert_batch(ForwardIt first, ForwardIt last, size_t grain = (size_t)-1) {
+		//insert all values of the range (unsorted, duplicates are kept)
+		std::vector<value_type> values = sortedBatch(first, last);
+		if (grain != (size_t)-1 && values.size() >= grain) {
+			RedBlackTree batch(comp, get_allocator());
+			batch.assign(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+			setOperation(SET_MERGE, batch, grain);
+			return;
+		}
+		nodeType* previous = NULL;
+		for (size_t i = 0; i < values.size(); i++) {
+			nodeType* node = createNode(std::move(values[i]));
+			insertAfter(node, previous);
+			insertFix(node);
+			previous = node;
+		}
+	}
+
+	template <typename ForwardIt>
+	void erase_batch(ForwardIt first, ForwardIt last, size_t grain = (size_t)-1) {
+		//delete all nodes with values found in the range (unsorted)
+		std::vector<value_type> values = sortedBatch(first, last);
+		if (grain != (size_t)-1 && values.size() >= grain) {
+			RedBlackTree batch(comp, get_allocator());
+			batch.assign(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+			setOperation(SET_DIFFERENCE, batch, grain);
+			return;
+		}
+		nodeType* node = NULL;
+		for (size_t i = 0; i < values.size(); i++) {
+			if (i > 0 && !lessThan(values[i - 1], values[i])) {
+				continue;
+			}
+			//the first node after the previous key is the finger for the next one, no node left means nothing more to erase
+			node = (i == 0) ? lowerBoundHelp(values[i]) : lowerBoundAfter(values[i], node);
+			if (node == NULL) {
+				break;
+			}
+			//erasing relinks nodes, so the successor stays valid
+			while (node != NULL && !lessThan(values[i], node->value)) {
+				nodeType* next = node->successor();
+				eraseHelp(node);
+				node = (next == header) ? NULL : next;
+			}
+		}
+	}
+
+	void join(const value_type& pivot, RedBlackTree&& tree2) {
+		//append pivot and then all nodes of tree2 (nodes of this tree <= pivot <= nodes of tree2), tree2 becomes empty
+		if (&tree2 == this) {
+			std::cout << "A tree can't be joined with itself!" << std::endl;
+			return;
+		}
+		if ((!empty() && lessThan(pivot, header->right->value)) || (!tree2.empty() && lessThan(tree2.header->left->value, pivot))) {
+			std::cout << "All the nodes belonging to tree1 should be less than (in value) pivot and all nodes of tree2!" << std::endl;
+			return;
+		}
+		if (nodeAlloc != tree2.nodeAlloc) {
+			insert(pivot);
+			join(std::move(tree2));
+			return;
+		}
+		nodeType* leftmost = empty() ? NULL : header->left;
+		nodeType* rightmost = tree2.empty() ? NULL : tree2.header->right;
+		nodeType* node = createNode(pivot);
+		joinHelp(node, blackHeight(root), tree2, blackHeight(tree2.root));
+		header->left = (leftmost != NULL) ? leftmost : node;
+		header->right = (rightmost != NULL) ? rightmost : node;
+	}
+
+	nodeType* root;
+
+private:
+
+	nodeAllocator nodeAlloc;
+	Compare comp;
+	//counters of Instrumented trees, copies and moved-to trees start with their own
+	//(otherwise empty, next to the usually empty allocator and comparator it takes no space)
+	mutable RedBlackStatsCollector<std::is_base_of<Instrumented, Augment>::value> statistics;
+	//parent of the root, its left and right point to the minimum and maximum (to itself if empty)
+	RedBlackHeaderStorage<nodeType> headerStorage;
+	nodeType* header = headerStorage.get();
+
+	void attach(nodeType* node) {
+		//make node the root, the cached min and max are kept
+		root = node;
+		if (node != NULL) {
+			node->setParent(header);
+		}
+	}
+
+	static nodeType* detach(nodeType* node) {
+		//make node the root of a separate subtree (parent NULL), split and join work on such subtrees
+		if (node != NULL) {
+			node->setParent(NULL);
+		}
+		return node;
+	}
+
+	void setRoot(nodeType* node) {
+		//make node the root and find the min and max in O(log n)
+		attach(node);
+		header->left = (node != NULL) ? node->min() : header;
+		header->right = (node != NULL) ? node->max() : header;
+	}
+
+	void propagateAllocator(const nodeAllocator& alloc, std::true_type) {
+		//called on an empty tree, the nodes of the old allocator are already freed
+		nodeAlloc = alloc;
+	}
+
+	void propagateAllocator(const nodeAllocator&, std::false_type) {}
+
+	void take(RedBlackTree& that) {
+		//move all nodes of that (with the same allocator) to this empty tree in O(1)
+		nodeType* leftmost = that.header->left;
+		nodeType* rightmost = that.header->right;
+		attach(that.root);
+		that.setRoot(NULL);
+		header->left = (root != NULL) ? leftmost : header;
+		header->right = (root != NULL) ? rightmost : header;
+	}
+
+	iterator toIterator(nodeType* node) {
+		return (node != NULL) ? iterator(node) : end();
+	}
+
+	nodeType* cloneHelp(nodeType* node) {
+		//copy the subtree of node with the same shape and colours
+		if (node == NULL) {
+			return NULL;
+		}
+		nodeType* copy = createNode(node->value);
+		copy->setColor(node->getColor());
+		copy->left = cloneHelp(node->left);
+		if (copy->left != NULL) {
+			copy->left->setParent(copy);
+		}
+		copy->right = cloneHelp(node->right);
+		if (copy->right != NULL) {
+			copy->right->setParent(copy);
+		}
+		nodeType::update(copy);
+		return copy;
+	}
+
+	template <typename A, typename B>
+	bool lessThan(const A& a, const B& b) const {
+		statistics.compared();
+		return lessHelp(a, b, isThreeWay<Compare>());
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::false_type) const {
+		return comp(a, b);
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::true_type) const {
+		return comp(a, b) < 0;
+	}
+
+	template <typename K>
+	nodeType* findHelp(const K& key) const {
+		return findHelp(key, isThreeWay<Compare>());
+	}
+
+	template <typename K>
+	nodeType* findHelp(const K& key, std::false_type) const {
+		//one comparison per level, equality is checked only at the end
+		nodeType* found = lowerBoundHelp(key);
+		if (found != NULL && lessThan(key, found->value)) {
+			return NULL;
+		}
+		return found;
+	}
+
+	template <typename K>
+	nodeType* findHelp(const K& key, std::true_type) const {
+		//three-way comparator stops at the first equal node
+		nodeType* current = root;
+		while (current != NULL) {
+			statistics.compared();
+			int result = comp(key, current->value);
+			if (result == 0) {
+				return current;
+			}
+			current = (result < 0) ? current->left : current->right;
+		}
+		return NULL;
+	}
+
+	template <typename K>
+	nodeType* lowerBoundHelp(const K& key) const {
+		nodeType* result = NULL;
+		nodeType* current = root;
+		while (current != NULL) {
+			if (lessThan(current->value, key)) {
+				current = current->right;
+			}
+			else {
+				result = current;
+				current = current->left;
+			}
+		}
+		return result;
+	}
+
+	template <typename K>
+	nodeType* lowerBoundAfter(const K& key, nodeType* finger) const {
+		//lower bound of key found from finger, which must not follow it (finger search, see insertAfter)
+		if (!lessThan(finger->value, key)) {
+			return finger;
+		}
+
+		nodeType* result = NULL;
+		nodeType* current = finger;
+		for (int height = 0; current != root; height++) {
+			nodeType* parent = current->getParent();
+			if (current == parent->left && !lessThan(parent->value, key)) {
+				result = parent;
+				break;
+			}
+			if (height == fingerClimb) {
+				return lowerBoundHelp(key);
+			}
+			current = parent;
+		}
+
+		while (current != NULL) {
+			if (lessThan(current->value, key)) {
+				current = current->right;
+			}
+			else {
+				result = current;
+				current = current->left;
+			}
+		}
+		return result;
+	}
+
+	template <typename K>
+	nodeType* upperBoundHelp(const K& key) const {
+		nodeType* result = NULL;
+		nodeType* current = root;
+		while (current != NULL) {
+			if (lessThan(key, current->value)) {
+				result = current;
+				current = current->left;
+			}
+			else {
+				current = current->right;
+			}
+		}
+		return result;
+	}
+
+	template <typename ForwardIt>
+	std::vector<value_type> sortedBatch(ForwardIt first, ForwardIt last) {
+		std::vector<value_type> values(first, last);
+		std::sort(values.begin(), values.end(), [this](const value_type& a, const value_type& b) { return lessThan(a, b); });
+		return values;
+	}
+
+	//batch keys more than about 2^fingerClimb nodes apart are found faster from the root, whose upper levels stay in the cache
+	static const int fingerClimb = 4;
+
+	static const size_t batchWidth = 16;
+
+	template <typename ForwardIt, typename OutputIt, bool Find>
+	OutputIt batchHelp(ForwardIt first, ForwardIt last, OutputIt out, std::integral_constant<bool, Find>) {
+		//group prefetching: every round moves each unfinished search of the group one level down and prefetches its next node
+		typedef typename std::iterator_traits<ForwardIt>::value_type keyType;
+		const keyType* keys[batchWidth];
+		nodeType* current[batchWidth];
+		nodeType* result[batchWidth];
+		while (first != last) {
+			size_t count = 0;
+			for (; first != last && count < batchWidth; ++first) {
+				keys[count] = &*first;
+				current[count] = root;
+				result[count] = NULL;
+				count++;
+			}
+
+			for (bool active = true; active;) {
+				active = false;
+				for (size_t i = 0; i < count; i++) {
+					nodeType* node = current[i];
+					if (node == NULL) {
+						continue;
+					}
+					if (lessThan(node->value, *keys[i])) {
+						node = node->right;
+					}
+					else {
+						result[i] = node;
+						node = node->left;
+					}
+					if (node != NULL) {
+						redBlackPrefetch(node);
+						active = true;
+					}
+					current[i] = node;
+				}
+			}
+
+			for (size_t i = 0; i < count; i++) {
+				*out++ = batchResult(result[i], *keys[i], std::integral_constant<bool, Find>());
+			}
+		}
+		return out;
+	}
+
+	template <typename K>
+	nodeType* batchResult(nodeType* lower, const K& key, std::true_type) {
+		return (lower != NULL && !lessThan(key, lower->value)) ? lower : NULL;
+	}
+
+	template <typename K>
+	iterator batchResult(nodeType* lower, const K&, std::false_type) {
+		return toIterator(lower);
+	}
+
+	template <typename... Args>
+	nodeType* createNode(Args&&... args) {
+		//the value is constructed in place from args
+		nodeType* node = allocateNode(std::integral_constant<bool, nodeType::indexed>());
+		nodeAllocTraits::construct(nodeAlloc, node, std::forward<Args>(args)...);
+		statistics.allocated();
+		return node;
+	}
+
+	void destroyNode(nodeType* node) {
+		destroyValue(node);
+		deallocateNode(node, std::integral_constant<bool, nodeType::indexed>());
+		statistics.deallocated();
+	}
+
+	//index-linked nodes always come from the arena of their type, Allocator is not used for them
+	nodeType* allocateNode(std::false_type) {
+		return nodeAllocTraits::allocate(nodeAlloc, 1);
 	}
 
-	void print() {
-		if (!empty()) {
-			printHelp(this->root, "", true);
-		}
+	nodeType* allocateNode(std::true_type) {
+		return RedBlackIndexArena<nodeType>::allocate();
 	}
 
-	void merge(RedBlackTree<value_type> tree2) {
-		// we can merge trees iff all the nodes belonging to tree1 <= all nodes of tree2 (due to algorithm)
+	void deallocateNode(nodeType* node, std::false_type) {
+		nodeAllocTraits::deallocate(nodeAlloc, node, 1);
+	}
 
-		value_type current_value;
-		nodeType* current_node;
-		nodeType* current_ptr = NULL;
-		nodeType* root1 = root;
-		nodeType* root2 = tree2.root;
+	void deallocateNode(nodeType* node, std::true_type) {
+		RedBlackIndexArena<nodeType>::deallocate(node);
+	}
 
-		if (root1->max()->value > root2->min()->value) {
-			std::cout << "All the nodes belonging to tree1 should be less than (in value) all nodes of tree2!" << std::endl;
-			return;
+	void destroyValue(nodeType* node) {
+		//the value is a union member, so the node does not destroy it
+		nodeAllocTraits::destroy(nodeAlloc, std::addressof(node->value));
+		nodeAllocTraits::destroy(nodeAlloc, node);
+	}
+
+	template <typename ForwardIt>
+	nodeType* buildSorted(ForwardIt& it, size_t count, int depth, int redDepth) {
+		//build the left half, then the middle node, then the right half (values are read in order)
+		if (count == 0) {
+			return NULL;
 		}
 
-		int height1 = blackHeight(root1);
-		int height2 = blackHeight(root2);
+		size_t leftCount = (count - 1) / 2;
+		nodeType* left = buildSorted(it, leftCount, depth + 1, redDepth);
 
-		//find current node and then delete it
-		if (height1 > height2) {
-			current_node = root1->max();
-			current_value = current_node->value;
-			erase(current_value);
-			root1 = root;
-		}
-		else if (height2 > height1) {
-			current_node = root2->min();
-			current_value = current_node->value;
-			tree2.erase(current_value);
-			root2 = tree2.root;
-		}
-		else {
-			current_node = root2->min();
-			current_value = current_node->value;
-			tree2.erase(current_value);
-			root2 = tree2.root;
+		nodeType* node = createNode(*it);
+		++it;
+		node->setColor((depth == redDepth) ? RED : BLACK);
 
-			if (height1 != blackHeight(root2)) {
-				tree2.insert(current_value);
-				root2 = tree2.root;
-				current_node = root1->max();
-				current_value = current_node->value;
-				erase(current_value);
-				root1 = root;
-			}
+		node->left = left;
+		if (left != NULL) {
+			left->setParent(node);
 		}
 
-		setColor(current_node, RED);
-		height1 = blackHeight(root1);
-		height2 = blackHeight(root2);
+		node->right = buildSorted(it, count - 1 - leftCount, depth + 1, redDepth);
+		if (node->right != NULL) {
+			node->right->setParent(node);
+		}
+		nodeType::update(node);
+		return node;
+	}
 
-		if (height1 == height2) {
-			//set current node as root and tree1 its left subtree, tree2 its right subtree
-			current_node->left = root1;
-			root1->parent = current_node;
-			current_node->right = root2;
-			root2->parent = current_node;
-			//root must be black
-			setColor(current_node, BLACK);
-			current_node->value = current_value;
-			root = current_node;
-		}
-		else if (height2 > height1) {
-			nodeType* current_ptr2 = root2;
-			//find node, which black height will be same as height of tree1
-			while (height1 != blackHeight(current_ptr2)) {
-				current_ptr = current_ptr2;
-				current_ptr2 = current_ptr2->left;
-			}
-
-			//find parent of this node
-			nodeType* parent_ptr;
-			if (current_ptr2 == NULL) {
-				parent_ptr = current_ptr;
-			}
-			else {
-				parent_ptr = current_ptr2->parent;
-			}
+	static const size_t parallelGrain = 16384;
 
-			//set tree1 as left subtree of current_node
-			current_node->left = root1;
-			if (root1 != NULL) {
-				root1->parent = current_node;
-			}
+	template <typename RandomIt>
+	void parallelSort(RandomIt first, RandomIt last, int forkDepth) {
+		auto less = [this](const value_type& a, const value_type& b) { return lessThan(a, b); };
+		if (forkDepth == 0 || size_t(last - first) < parallelGrain) {
+			std::sort(first, last, less);
+			return;
+		}
+		RandomIt middle = first + (last - first) / 2;
+		std::future<void> task = std::async(std::launch::async, [&]() {
+			parallelSort(first, middle, forkDepth - 1);
+		});
+		parallelSort(middle, last, forkDepth - 1);
+		task.get();
+		std::inplace_merge(first, middle, last, less);
+	}
 
-			//set subtree which starts from current_ptr2 as right subtree of current node
-			current_node->right = current_ptr2;
-			if (current_ptr2 != NULL) {
-				current_ptr2->parent = current_node;
-			}
+	template <typename RandomIt>
+	nodeType* buildParallel(RandomIt first, size_t count, int depth, int redDepth, int forkDepth) {
+		//same shape as buildSorted, the left half is built in a new thread while forkDepth > 0
+		if (forkDepth == 0 || count < parallelGrain) {
+			return buildSorted(first, count, depth, redDepth);
+		}
 
-			//set sibling of current_ptr2 as current node
-			parent_ptr->left = current_node;
-			current_node->parent = parent_ptr;
+		size_t leftCount = (count - 1) / 2;
+		std::future<nodeType*> task = std::async(std::launch::async, [&]() {
+			return buildParallel(first, leftCount, depth + 1, redDepth, forkDepth - 1);
+		});
+		nodeType* node = createNode(first[leftCount]);
+		node->setColor((depth == redDepth) ? RED : BLACK);
+		node->right = buildParallel(first + leftCount + 1, count - 1 - leftCount, depth + 1, redDepth, forkDepth - 1);
+		node->right->setParent(node);
+		node->left = task.get();
+		node->left->setParent(node);
+		nodeType::update(node);
+		return node;
+	}
 
-			//balance tree
-			if (getColor(parent_ptr) == RED) {
-				insertFix(current_node);
+	void destroySubtree(nodeType* node, bool valuesOnly) {
+		//rotate left children up until node has none, then node can go and its right child is next
+		//parents are not used, so the depth of the subtree doesn't matter
+		while (node != NULL) {
+			nodeType* left = node->left;
+			if (left != NULL) {
+				node->left = left->right;
+				left->right = node;
+				node = left;
 			}
-			else if (getColor(current_ptr2) == RED) {
-				insertFix(current_ptr2);
+			else {
+				nodeType* right = node->right;
+				if (valuesOnly) {
+					destroyValue(node);
+				}
+				else {
+					destroyNode(node);
+				}
+				node = right;
 			}
-
-			current_node->value = current_value;
-			root = root2;
 		}
-		else {
-			nodeType* current_ptr2 = root1;
-			//find node, which black height will be same as height of tree2
-			while (height2 != blackHeight(current_ptr2)) {
-				current_ptr2 = current_ptr2->right;
-			}
-			//find parent of this node
-			nodeType* parent_ptr = current_ptr2->parent;
-			//set right child of current node as root2 and left child as current_ptr2
-			current_node->right = root2;
-			root2->parent = current_node;
-			current_node->left = current_ptr2;
-			current_ptr2->parent = current_node;
-			//set sibling of current_ptr2 as current node
-			parent_ptr->right = current_node;
-			current_node->parent = parent_ptr;
-			//balance tree
-			if (getColor(parent_ptr) == RED) {
-				insertFix(current_node);
-			}
-			else if (getColor(current_ptr2) == RED) {
-				insertFix(current_ptr2);
-			}
-			current_node->value = current_value;
-			root = root1;
-		}
-		return;
 	}
 
-	nodeType* root;
+	//pool allocators free all nodes at once if no other tree uses the pool
+	template <typename A>
+	typename std::enable_if<hasRelease<A>::value, bool>::type releaseNodes(A& alloc) {
+		if (!alloc.unique() || nodeType::indexed) {
+			return false;
+		}
+		//nodes declare a destructor (the value is a union member), so the value and augment are checked
+		if (!std::is_trivially_destructible<value_type>::value || !std::is_trivially_destructible<Augment>::value) {
+			destroySubtree(root, true);
+		}
+		alloc.release();
+		return true;
+	}
 
-private:
+	template <typename A>
+	typename std::enable_if<!hasRelease<A>::value, bool>::type releaseNodes(A&) {
+		return false;
+	}
 
 	Color getColor(nodeType* node) {
 		if (node == NULL) {
 			return BLACK;
 		}
-		return node->color;
+		return node->getColor();
 	}
 
 	void setColor(nodeType* node, Color color) {
 		if (node == NULL) {
 			return;
 		}
-		node->color = color;
+		node->setColor(color);
 	}
 
-	void changeValues(nodeType* node1, nodeType* node2) {
-		value_type temp;
-		temp = node1->value;
-		node1->value = node2->value;
-		node2->value = temp;
-	}
-
-	nodeType* changeFind(nodeType* node) {
-		if (node->left != NULL && node->right != NULL) {
-			return (node->right)->min();
+	void updatePath(nodeType* node) {
+		//recompute augmented data from node up to the root (the header has no parent)
+		if (!nodeType::augmented) {
+			return;
 		}
-
-		if (node->left == NULL && node->right == NULL) {
-			return NULL;
+		while (node->getParent() != NULL) {
+			nodeType::update(node);
+			node = node->getParent();
 		}
+	}
 
-		if (node->left != NULL) {
-			return node->left;
-		}
-		else {
-			return node->right;
+	static int heightHelp(const nodeType* node) {
+		//number of nodes on the longest path down from node, recursion depth is the height (O(log n))
+		if (node == NULL) {
+			return 0;
 		}
+		return 1 + std::max(heightHelp(node->left), heightHelp(node->right));
 	}
 
 	int blackHeight(nodeType* node) {
@@ -455,309 +1953,759 @@ private:
 	}
 
 	void leftRotate(nodeType* node) {
-		//make node left child of its right child
+		leftRotate(node, root);
+	}
+
+	void leftRotate(nodeType* node, nodeType*& top) {
+		//make node left child of its right child, top is the root of the (sub)tree
+		statistics.rotated(true);
 		nodeType* helper = node->right;
 		node->right = helper->left;
 
 		if (node->right != NULL) {
-			node->right->parent = node;
+			node->right->setParent(node);
 		}
 
-		helper->parent = node->parent;
+		helper->setParent(node->getParent());
 
-		if (node->parent == NULL) {
-			root = helper;
+		if (node == top) {
+			top = helper;
 		}
-		else if (node == node->parent->left) {
-			node->parent->left = helper;
+		else if (node == node->getParent()->left) {
+			node->getParent()->left = helper;
 		}
 		else {
-			node->parent->right = helper;
+			node->getParent()->right = helper;
 		}
 
 		helper->left = node;
-		node->parent = helper;
+		node->setParent(helper);
+
+		nodeType::update(node);
+		nodeType::update(helper);
 	}
 
 	void rightRotate(nodeType* node) {
-		//make node right child of its left child
+		rightRotate(node, root);
+	}
+
+	void rightRotate(nodeType* node, nodeType*& top) {
+		//make node right child of its left child, top is the root of the (sub)tree
+		statistics.rotated(false);
 		nodeType* helper = node->left;
 		node->left = helper->right;
 
 		if (node->left != NULL) {
-			node->left->parent = node;
+			node->left->setParent(node);
 		}
 
-		helper->parent = node->parent;
+		helper->setParent(node->getParent());
 
-		if (node->parent == NULL) {
-			root = helper;
+		if (node == top) {
+			top = helper;
 		}
-		else if (node == node->parent->left) {
-			node->parent->left = helper;
+		else if (node == node->getParent()->left) {
+			node->getParent()->left = helper;
 		}
 		else {
-			node->parent->right = helper;
+			node->getParent()->right = helper;
 		}
 
 		helper->right = node;
-		node->parent = helper;
+		node->setParent(helper);
+
+		nodeType::update(node);
+		nodeType::update(helper);
 	}
 
 	void insertHelp(nodeType* node) {
+		//find the leaf where node belongs (equal values go right)
+		nodeType* parent = NULL;
+		nodeType* current = root;
+		bool left = false;
 
-		if (empty()) {
-			setColor(node, BLACK);
-			root = node;
+		//appending past the cached maximum (sorted input) is O(1)
+		if (root != NULL && !lessThan(node->value, header->right->value)) {
+			linkNode(node, header->right, false);
+			return;
+		}
+
+		while (current != NULL) {
+			parent = current;
+			left = lessThan(node->value, current->value);
+			current = left ? current->left : current->right;
+		}
+
+		linkNode(node, parent, left);
+	}
+
+	void insertAfter(nodeType* node, nodeType* finger) {
+		//finger <= node: climb from finger to the first ancestor greater than node, node belongs to that left subtree
+		//(searched from the root if the ancestor is more than fingerClimb levels up)
+		if (finger == NULL || !lessThan(node->value, header->right->value)) {
+			insertHelp(node);
 			return;
 		}
 
+		nodeType* current = finger;
+		for (int height = 0; current != root; height++) {
+			nodeType* parent = current->getParent();
+			if (current == parent->left && lessThan(node->value, parent->value)) {
+				break;
+			}
+			if (height == fingerClimb) {
+				insertHelp(node);
+				return;
+			}
+			current = parent;
+		}
+
 		nodeType* parent = NULL;
+		bool left = false;
+		while (current != NULL) {
+			parent = current;
+			left = lessThan(node->value, current->value);
+			current = left ? current->left : current->right;
+		}
+		linkNode(node, parent, left);
+	}
+
+	void insertHint(nodeType* node, nodeType* hint) {
+		//node fits right before hint if predecessor(hint) <= node <= hint
+		if (hint == NULL || hint == header) {
+			insertHelp(node);
+			return;
+		}
+		if (lessThan(hint->value, node->value)) {
+			insertHelp(node);
+			return;
+		}
+
+		nodeType* previous = hint->predecessor();
+		if (previous != header && lessThan(node->value, previous->value)) {
+			insertHelp(node);
+			return;
+		}
+
+		//either hint has no left child, or its predecessor (max of the left subtree) has no right child
+		if (hint->left == NULL) {
+			linkNode(node, hint, true);
+		}
+		else {
+			linkNode(node, previous, false);
+		}
+	}
+
+	template <typename K>
+	nodeType* uniquePosition(const K& key, nodeType*& parent, bool& left) const {
+		//returns node equal to key, or NULL and the place for a new node with key
+		nodeType* candidate = NULL;
 		nodeType* current = root;
+		parent = NULL;
+		left = false;
 
 		while (current != NULL) {
 			parent = current;
-			if (node->value < current->value) {
+			left = lessThan(key, current->value);
+			if (left) {
 				current = current->left;
 			}
 			else {
+				candidate = current;
 				current = current->right;
 			}
 		}
 
-		node->parent = parent;
+		if (candidate != NULL && !lessThan(candidate->value, key)) {
+			return candidate;
+		}
+		return NULL;
+	}
+
+	void linkNode(nodeType* node, nodeType* parent, bool left) {
+		//attach node as a child of parent, the tree is balanced by insertFix
+		if (parent == NULL) {
+			node->setColor(BLACK);
+			attach(node);
+			header->left = header->right = node;
+			nodeType::update(node);
+			return;
+		}
+
+		node->setParent(parent);
 
-		if (node->value < parent->value) {
+		if (left) {
 			parent->left = node;
+			if (parent == header->left) {
+				header->left = node;
+			}
 		}
 		else {
 			parent->right = node;
+			if (parent == header->right) {
+				header->right = node;
+			}
 		}
 
-		return;
+		updatePath(node);
 	}
 
-	void insertFix(nodeType* node) {
+	bool insertFix(nodeType* node) {
+		return insertFix(node, root);
+	}
+
+	bool insertFix(nodeType* node, nodeType*& top) {
+		//returns true if the black height of the (sub)tree with root top grew (red root was recoloured)
 		nodeType* uncle;
 
-		if (node == root) {
-			return;
+		if (node == top) {
+			return false;
 		}
 
+		//the parent of a red parent is never NULL (top is black), only the uncle may be
 		//check the colour of the parent node
 		//if its colour is black then dont change the colour
 		//if its colour is red then check the colour of the nodes uncle
-		while (getColor(node->parent) == RED) {
+		while (node != top && node->getParent()->getColor() == RED) {
 			//if parent is right child of grandparent -> uncle is left child
-			if (node->parent == node->parent->parent->right) {
-				uncle = node->parent->parent->left;
+			if (node->getParent() == node->getParent()->getParent()->right) {
+				uncle = node->getParent()->getParent()->left;
 				//if uncle has a red colour (same as parent) 
 				//then change the colour of uncle and parent to black and the colour of grandfather to red 
 				//and repeat the same process for grandfather
 				if (getColor(uncle) == RED) {
-					setColor(uncle, BLACK);
-					setColor(node->parent, BLACK);
-					setColor(node->parent->parent, RED);
-					node = node->parent->parent;
+					statistics.recolored(3);
+					uncle->setColor(BLACK);
+					node->getParent()->setColor(BLACK);
+					node->getParent()->getParent()->setColor(RED);
+					node = node->getParent()->getParent();
 				}
 				//if uncle has a black colour
 				else {
 					//right-left case
-					if (node == node->parent->left) {
-						node = node->parent;
-						rightRotate(node);
+					if (node == node->getParent()->left) {
+						node = node->getParent();
+						rightRotate(node, top);
 					}
 					//right-right case
-					setColor(node->parent, BLACK);
-					setColor(node->parent->parent, RED);
-					leftRotate(node->parent->parent);
+					statistics.recolored(2);
+					node->getParent()->setColor(BLACK);
+					node->getParent()->getParent()->setColor(RED);
+					leftRotate(node->getParent()->getParent(), top);
 				}
 			}
 			//if parent is left child of grandparent -> uncle is right child
 			else {
-				uncle = node->parent->parent->right;
+				uncle = node->getParent()->getParent()->right;
 				//if uncle has a red colour (same as parent) 
 				//then change the colour of uncle and parent to black and the colour of grandfather to red 
 				//and repeat the same process for grandfather
 				if (getColor(uncle) == RED) {
-					setColor(uncle, BLACK);
-					setColor(node->parent, BLACK);
-					setColor(node->parent->parent, RED);
-					node = node->parent->parent;
+					statistics.recolored(3);
+					uncle->setColor(BLACK);
+					node->getParent()->setColor(BLACK);
+					node->getParent()->getParent()->setColor(RED);
+					node = node->getParent()->getParent();
 				}
 				//if uncle has a black colour
 				else {
 					//left-right case
-					if (node == node->parent->right) {
-						node = node->parent;
-						leftRotate(node);
+					if (node == node->getParent()->right) {
+						node = node->getParent();
+						leftRotate(node, top);
 					}
 					//left-left case
-					setColor(node->parent, BLACK);
-					setColor(node->parent->parent, RED);
-					rightRotate(node->parent->parent);
+					statistics.recolored(2);
+					node->getParent()->setColor(BLACK);
+					node->getParent()->getParent()->setColor(RED);
+					rightRotate(node->getParent()->getParent(), top);
 				}
 			}
 		}
-		setColor(root, BLACK);
+		bool grown = (top->getColor() == RED);
+		top->setColor(BLACK);
+		return grown;
 	}
 
 	void eraseHelp(nodeType* node) {
-		//we delete only a node which is a leaf or has only one child
-		//node2 - the child that replace node
-		nodeType* node2 = changeFind(node);
-		nodeType* parent = node->parent;
-		bool bothBlack = ((node2 == NULL || getColor(node2) == BLACK) && (getColor(node) == BLACK));
+		unlinkNode(node);
+		destroyNode(node);
+	}
+
+	void replaceNode(nodeType* node, nodeType* node2) {
+		//put node2 (may be NULL) to the place of node
+		if (node == root) {
+			root = node2;
+		}
+		else if (node == node->getParent()->left) {
+			node->getParent()->left = node2;
+		}
+		else {
+			node->getParent()->right = node2;
+		}
+
+		if (node2 != NULL) {
+			node2->setParent(node->getParent());
+		}
+	}
+
+	void unlinkNode(nodeType* node) {
+		//remove node from the tree by relinking, values are never copied
+		//child - the node that takes the place of the removed one (may be NULL)
+		nodeType* child;
+		nodeType* parent;
+		Color removedColor = node->getColor();
+
+		//the neighbours of the cached min and max take their place (the header if the tree becomes empty)
+		if (node == header->left) {
+			header->left = node->successor();
+		}
+		if (node == header->right) {
+			header->right = node->predecessor();
+		}
+
+		if (node->left == NULL || node->right == NULL) {
+			//node has at most 1 child, replace node with it
+			child = (node->left != NULL) ? node->left : node->right;
+			parent = node->getParent();
+			replaceNode(node, child);
+		}
+		else {
+			//node has 2 children, its successor takes its place and colour
+			nodeType* successor = node->right->min();
+			removedColor = successor->getColor();
+			child = successor->right;
 
-		//node is a leaf
-		if (node2 == NULL) {
-			if (node == root) {
-				root = NULL;
+			if (successor->getParent() == node) {
+				parent = successor;
 			}
 			else {
-				if (bothBlack) {
-					//node and node2 are black
-					//balance the tree if node is a leaf
-					eraseFix(node);
+				parent = successor->getParent();
+				replaceNode(successor, child);
+				successor->right = node->right;
+				successor->right->setParent(successor);
+			}
+
+			replaceNode(node, successor);
+			successor->left = node->left;
+			successor->left->setParent(successor);
+			successor->setColor(node->getColor());
+		}
+
+		updatePath(parent);
+
+		//removing a black node shortens paths through child
+		if (removedColor == BLACK) {
+			eraseFix(child, parent);
+		}
+
+		node->setParent(NULL);
+		node->left = node->right = NULL;
+		node->setColor(RED);
+		nodeType::update(node);
+	}
+
+	void eraseFix(nodeType* node, nodeType* parent) {
+		//node (may be NULL) has one black less than its sibling, so parent and sibling are never NULL
+		nodeType* sibling;
+
+		while (node != root && getColor(node) == BLACK) {
+			//node is left child
+			if (node == parent->left) {
+				sibling = parent->right;
+				//sibling is red -> rotate, so that node gets a black sibling
+				if (sibling->getColor() == RED) {
+					statistics.recolored(2);
+					sibling->setColor(BLACK);
+					parent->setColor(RED);
+					leftRotate(parent);
+					sibling = parent->right;
+				}
+				//all childrens of sibling are black -> recolour and move up
+				if (getColor(sibling->left) == BLACK && getColor(sibling->right) == BLACK) {
+					statistics.recolored(1);
+					sibling->setColor(RED);
+					node = parent;
+					parent = node->getParent();
 				}
 				else {
-					//node or node2 is red
-					//if sibling is not NULL, set its color to red
-					if (node == parent->left) {
-						if (parent->right != NULL) {
-							setColor(parent->right, RED);
-						}
-					}
-					else {
-						if (parent->left != NULL) {
-							setColor(parent->left, RED);
-						}
+					//right-left case
+					if (getColor(sibling->right) == BLACK) {
+						statistics.recolored(2);
+						sibling->left->setColor(BLACK);
+						sibling->setColor(RED);
+						rightRotate(sibling);
+						sibling = parent->right;
 					}
+					//right-right case
+					statistics.recolored(3);
+					sibling->setColor(parent->getColor());
+					parent->setColor(BLACK);
+					sibling->right->setColor(BLACK);
+					leftRotate(parent);
+					node = root;
 				}
-
-				//delete node from the tree
-				if (node == parent->left) {
-					parent->left = NULL;
+			}
+			//node is right child
+			else {
+				sibling = parent->left;
+				//sibling is red -> rotate, so that node gets a black sibling
+				if (sibling->getColor() == RED) {
+					statistics.recolored(2);
+					sibling->setColor(BLACK);
+					parent->setColor(RED);
+					rightRotate(parent);
+					sibling = parent->left;
+				}
+				//all childrens of sibling are black -> recolour and move up
+				if (getColor(sibling->left) == BLACK && getColor(sibling->right) == BLACK) {
+					statistics.recolored(1);
+					sibling->setColor(RED);
+					node = parent;
+					parent = node->getParent();
 				}
 				else {
-					parent->right = NULL;
+					//left-right case
+					if (getColor(sibling->left) == BLACK) {
+						statistics.recolored(2);
+						sibling->right->setColor(BLACK);
+						sibling->setColor(RED);
+						leftRotate(sibling);
+						sibling = parent->left;
+					}
+					//left-left case
+					statistics.recolored(3);
+					sibling->setColor(parent->getColor());
+					parent->setColor(BLACK);
+					sibling->left->setColor(BLACK);
+					rightRotate(parent);
+					node = root;
 				}
 			}
-			delete node;
-			return;
 		}
+		setColor(node, BLACK);
+	}
 
-		//node has 1 child
-		if (node->left == NULL || node->right == NULL) {
-			if (node == root) {
-				//assign the value of node2 to node and delete node2
-				node->value = node2->value;
-				node->left = node->right = NULL;
-				delete node2;
+	int joinHelp(nodeType* pivot, int height1, RedBlackTree& tree2, int height2) {
+		//link this tree (black height height1), pivot and tree2 (black height height2), tree2 becomes empty
+		//returns black height of the joined tree, the cached min and max are kept
+		nodeType* root2 = tree2.root;
+		tree2.setRoot(NULL);
+		int height;
+		attach(joinNodes(detach(root), height1, pivot, detach(root2), height2, height));
+		return height;
+	}
+
+	nodeType* joinNodes(nodeType* root1, int height1, nodeType* pivot, nodeType* root2, int height2, int& height) {
+		//link separate subtrees root1 (black height height1), pivot and root2 (black height height2) in O(|height1 - height2|)
+		//returns root of the joined subtree (parent NULL), height becomes its black height
+		//roots of both subtrees must be black
+		if (getColor(root1) == RED) {
+			setColor(root1, BLACK);
+			height1++;
+		}
+		if (getColor(root2) == RED) {
+			setColor(root2, BLACK);
+			height2++;
+		}
+
+		pivot->setParent(NULL);
+		pivot->left = pivot->right = NULL;
+		setColor(pivot, RED);
+
+		if (height1 == height2) {
+			//pivot is the new root, root1 its left subtree, root2 its right subtree
+			pivot->left = root1;
+			pivot->right = root2;
+			if (root1 != NULL) {
+				root1->setParent(pivot);
 			}
-			else {
-				//replace node with node2 and delete node
-				if (node == parent->left) {
-					parent->left = node2;
-				}
-				else {
-					parent->right = node2;
-				}
-				delete node;
-				node2->parent = parent;
+			if (root2 != NULL) {
+				root2->setParent(pivot);
+			}
+			setColor(pivot, BLACK);
+			nodeType::update(pivot);
+			height = height1 + 1;
+			return pivot;
+		}
 
-				if (bothBlack) {
-					//balance the tree if node and node2 are black
-					eraseFix(node2);
+		height = (height1 > height2) ? height1 : height2;
+		nodeType* top;
+		nodeType* current;
+		nodeType* parent = NULL;
+		if (height1 > height2) {
+			//go down the right spine of root1 to the black node with the same black height as root2
+			current = root1;
+			while (current != NULL && (getColor(current) == RED || height1 > height2)) {
+				if (getColor(current) == BLACK) {
+					height1--;
 				}
-				else {
-					//if node or node2 ais red, set node2 color to black
-					setColor(node2, BLACK);
+				parent = current;
+				current = current->right;
+			}
+
+			//pivot replaces that node, which becomes left subtree of pivot
+			pivot->left = current;
+			pivot->right = root2;
+			parent->right = pivot;
+			top = root1;
+		}
+		else {
+			//go down the left spine of root2 to the black node with the same black height as root1
+			current = root2;
+			while (current != NULL && (getColor(current) == RED || height2 > height1)) {
+				if (getColor(current) == BLACK) {
+					height2--;
 				}
+				parent = current;
+				current = current->left;
+			}
+
+			//pivot replaces that node, which becomes right subtree of pivot
+			pivot->left = root1;
+			pivot->right = current;
+			parent->left = pivot;
+			top = root2;
+		}
+
+		pivot->setParent(parent);
+		if (pivot->left != NULL) {
+			pivot->left->setParent(pivot);
+		}
+		if (pivot->right != NULL) {
+			pivot->right->setParent(pivot);
+		}
+		if (nodeType::augmented) {
+			//the root of a separate subtree has no parent, so the whole path is updated (unlike updatePath)
+			for (nodeType* node = pivot; node != NULL; node = node->getParent()) {
+				nodeType::update(node);
 			}
+		}
+
+		//pivot is red, balance the subtree if its parent is red too
+		if (insertFix(pivot, top)) {
+			height++;
+		}
+		return top;
+	}
+
+	nodeType* splitMin(nodeType* node, int height, nodeType*& min, int& restHeight) {
+		//remove the minimum of the separate subtree node (black height height) in O(log n)
+		//returns root of the remaining subtree, restHeight becomes its black height
+		int childHeight = (getColor(node) == BLACK) ? height - 1 : height;
+		nodeType* left = detach(node->left);
+		nodeType* right = detach(node->right);
+		if (left == NULL) {
+			//the right subtree is empty or a single red node
+			min = node;
+			restHeight = childHeight;
+			return right;
+		}
+		int leftHeight;
+		nodeType* rest = splitMin(left, childHeight, min, leftHeight);
+		return joinNodes(rest, leftHeight, node, right, childHeight, restHeight);
+	}
+
+	void splitHelp(nodeType* node, int height, const value_type& key, bool inclusive, nodeType*& less, int& heightLess, nodeType*& greater, int& heightGreater) {
+		//split the separate subtree of node (black height height) to subtrees of nodes < key and nodes >= key
+		//(nodes <= key and nodes > key if inclusive)
+		if (node == NULL) {
+			less = greater = NULL;
+			heightLess = heightGreater = 0;
 			return;
 		}
-		// id node has 2 children, change values with node2 and recurse
-		changeValues(node2, node);
-		eraseHelp(node2);
+
+		//children become separate subtrees, node is the pivot to join them back
+		int childHeight = (getColor(node) == BLACK) ? height - 1 : height;
+		nodeType* left = detach(node->left);
+		nodeType* right = detach(node->right);
+
+		if (lessThan(node->value, key) || (inclusive && !lessThan(key, node->value))) {
+			//node and its left subtree are < key, split the right subtree
+			splitHelp(right, childHeight, key, inclusive, less, heightLess, greater, heightGreater);
+			less = joinNodes(left, childHeight, node, less, heightLess, heightLess);
+		}
+		else {
+			//node and its right subtree are >= key, split the left subtree
+			splitHelp(left, childHeight, key, inclusive, less, heightLess, greater, heightGreater);
+			greater = joinNodes(greater, heightGreater, node, right, childHeight, heightGreater);
+		}
 	}
 
-	void eraseFix(nodeType* node) {
-		if (node == root) {
+	//SET_MERGE keeps all nodes of both trees (multiset union)
+	enum SetOperation { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE, SET_MERGE };
+
+	void setOperation(SetOperation operation, RedBlackTree& tree2, size_t grain) {
+		if (nodeAlloc != tree2.nodeAlloc) {
+			//nodes can't be moved between different pools, so they are copied
+			RedBlackTree copy(comp, get_allocator());
+			copy.assign(tree2.begin(), tree2.end());
+			tree2.clear();
+			setOperation(operation, copy, grain);
 			return;
 		}
 
-		nodeType* sibling;
-		if (node == node->parent->left) {
-			sibling = node->parent->right;
+		//fork only if nodes can be freed from more threads at once (stateless allocators) and nothing is counted
+		int forkDepth = 0;
+		if (nodeAllocTraits::is_always_equal::value && !nodeType::indexed && !statistics.enabled) {
+			unsigned threads = std::thread::hardware_concurrency();
+			while ((1u << forkDepth) < threads) {
+				forkDepth++;
+			}
+			forkDepth++;
+		}
+
+		nodeType* node1 = root;
+		nodeType* node2 = tree2.root;
+		setRoot(NULL);
+		tree2.setRoot(NULL);
+
+		//the recursion works on separate subtrees, only the result becomes a tree again
+		int height;
+		setRoot(setHelp(operation, detach(node1), blackHeight(node1), detach(node2), blackHeight(node2), NULL, false, NULL, false, height, grain, forkDepth));
+	}
+
+	nodeType* setHelp(SetOperation operation, nodeType* node1, int height1, nodeType* node2, int height2,
+		const value_type* low, bool lowFound, const value_type* high, bool highFound,
+		int& height, size_t grain, int forkDepth) {
+		//combine separate subtrees of node1 and node2, all their values are between low and high
+		//lowFound/highFound - tree2 contained a node equal to low/high, it was removed higher in the recursion
+		//returns root of the resulting subtree, height becomes its black height
+		height = 0;
+
+		if (node1 == NULL) {
+			if (operation == SET_UNION || operation == SET_MERGE) {
+				height = height2;
+				return node2;
+			}
+			destroySubtree(node2, false);
+			return NULL;
+		}
+
+		if (node2 == NULL && !lowFound && !highFound) {
+			if (operation == SET_INTERSECTION) {
+				destroySubtree(node1, false);
+				return NULL;
+			}
+			height = height1;
+			return node1;
+		}
+
+		//split subtree of node2 to values < key, == key and > key
+		const value_type& key = node1->value;
+		nodeType* less;
+		nodeType* greater;
+		nodeType* rest;
+		int heightLess, heightGreater, heightRest;
+		splitHelp(node2, height2, key, false, less, heightLess, rest, heightRest);
+		bool found = false;
+		if (operation == SET_MERGE) {
+			//equal values of tree2 are kept right of node1
+			greater = rest;
+			heightGreater = heightRest;
 		}
 		else {
-			sibling = node->parent->left;
+			nodeType* equal;
+			int heightEqual;
+			splitHelp(rest, heightRest, key, true, equal, heightEqual, greater, heightGreater);
+			found = (equal != NULL) || (lowFound && !lessThan(low[0], key)) || (highFound && !lessThan(key, high[0]));
+			destroySubtree(equal, false);
 		}
 
-		if (sibling == NULL) {
-			//if not sibling, recurse to parent
-			eraseFix(node->parent);
+		//children of node1 become separate subtrees
+		nodeType* left = detach(node1->left);
+		nodeType* right = detach(node1->right);
+		int childHeight = (getColor(node1) == BLACK) ? height1 - 1 : height1;
+
+		nodeType* resultLeft;
+		nodeType* resultRight;
+		int heightLeft, heightRight;
+		size_t size = (size_t(1) << (height1 < 40 ? height1 : 40)) + (size_t(1) << (height2 < 40 ? height2 : 40));
+
+		if (forkDepth > 0 && size >= grain) {
+			//left half runs in a new thread, right half in this one
+			std::future<nodeType*> task = std::async(std::launch::async, [&]() {
+				return setHelp(operation, left, childHeight, less, heightLess, low, lowFound, &key, found, heightLeft, grain, forkDepth - 1);
+			});
+			resultRight = setHelp(operation, right, childHeight, greater, heightGreater, &key, found, high, highFound, heightRight, grain, forkDepth - 1);
+			resultLeft = task.get();
 		}
 		else {
-			//sibling is red -> change its color to black and parent's color to black
-			if (getColor(sibling) == RED) {
-				setColor(node->parent, RED);
-				setColor(sibling, BLACK);
-				//sibling is left child
-				if (sibling == sibling->parent->left) {
-					rightRotate(node->parent);
-				}
-				//sibling is right child
-				else {
-					leftRotate(node->parent);
-				}
-				eraseFix(node);
+			resultLeft = setHelp(operation, left, childHeight, less, heightLess, low, lowFound, &key, found, heightLeft, grain, 0);
+			resultRight = setHelp(operation, right, childHeight, greater, heightGreater, &key, found, high, highFound, heightRight, grain, 0);
+		}
+
+		if (operation == SET_UNION || operation == SET_MERGE || (operation == SET_INTERSECTION) == found) {
+			//keep node1 and use it to join both halves
+			return joinNodes(resultLeft, heightLeft, node1, resultRight, heightRight, height);
+		}
+
+		destroyNode(node1);
+		if (resultRight == NULL) {
+			height = heightLeft;
+			return resultLeft;
+		}
+		if (resultLeft == NULL) {
+			height = heightRight;
+			return resultRight;
+		}
+		//minimum of the right half joins both halves
+		nodeType* pivot;
+		resultRight = splitMin(resultRight, heightRight, pivot, heightRight);
+		return joinNodes(resultLeft, heightLeft, pivot, resultRight, heightRight, height);
+	}
+
+	template <typename Visitor>
+	void forEachHelp(nodeType* node, Visitor& visitor) {
+		//recursion only for left children, right children are visited in the loop
+		while (node != NULL) {
+			forEachHelp(node->left, visitor);
+			visitor(node->value);
+			node = node->right;
+		}
+	}
+
+	template <typename Visitor>
+	void forEachHelp(nodeType* node, const value_type& low, const value_type& high, Visitor& visitor) {
+		//find the highest node in the range, then everything left of it is < high and right of it is >= low
+		while (node != NULL && (lessThan(node->value, low) || !lessThan(node->value, high))) {
+			node = lessThan(node->value, low) ? node->right : node->left;
+		}
+		if (node == NULL) {
+			return;
+		}
+		forEachFrom(node->left, low, visitor);
+		visitor(node->value);
+		forEachUntil(node->right, high, visitor);
+	}
+
+	template <typename Visitor>
+	void forEachFrom(nodeType* node, const value_type& low, Visitor& visitor) {
+		//nodes >= low in the subtree of node
+		while (node != NULL) {
+			if (lessThan(node->value, low)) {
+				node = node->right;
 			}
-			//sibling is black
 			else {
-				//if sibling nas at least 1 red child
-				if (getColor(sibling->left) == RED || getColor(sibling->right) == RED) {
-					if (sibling->left != NULL and getColor(sibling->left) == RED) {
-						//left-left case
-						if (sibling == sibling->parent->left) {
-							setColor(sibling->left, getColor(sibling));
-							setColor(sibling, getColor(node->parent));
-							rightRotate(node->parent);
-						}
-						//right-left case
-						else {
-							setColor(sibling->left, getColor(node->parent));
-							rightRotate(sibling);
-							leftRotate(node->parent);
-						}
-					}
-					else {
-						//left-right case
-						if (sibling == sibling->parent->left) {
-							setColor(sibling->right, getColor(node->parent));
-							leftRotate(sibling);
-							rightRotate(node->parent);
-						}
-						//right-right case
-						else {
-							setColor(sibling->right, getColor(sibling));
-							setColor(sibling, getColor(node->parent));
-							leftRotate(node->parent);
-						}
-					}
-					setColor(node->parent, BLACK);
-				}
-				//if all childrens of sibling are black
-				else {
-					setColor(sibling, RED);
-					if (getColor(node->parent) == BLACK) {
-						eraseFix(node->parent);
-					}
-					else {
-						setColor(node->parent, BLACK);
-					}
-				}
+				forEachFrom(node->left, low, visitor);
+				visitor(node->value);
+				forEachHelp(node->right, visitor);
+				return;
+			}
+		}
+	}
+
+	template <typename Visitor>
+	void forEachUntil(nodeType* node, const value_type& high, Visitor& visitor) {
+		//nodes < high in the subtree of node
+		while (node != NULL) {
+			if (!lessThan(node->value, high)) {
+				node = node->left;
+			}
+			else {
+				forEachHelp(node->left, visitor);
+				visitor(node->value);
+				node = node->right;
 			}
 		}
 	}
@@ -774,7 +2722,7 @@ private:
 			separator += "   ";
 
 			std::string nodeColor = "BLACK";
-			if (node->color == RED) {
+			if (node->getColor() == RED) {
 				nodeColor = "RED";
 			}
 			std::cout << node->value << "(" << nodeColor << ")" << std::endl;
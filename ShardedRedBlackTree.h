@@ -0,0 +1,377 @@
+#ifndef SHARDEDREDBLACKTREE_H
+#define SHARDEDREDBLACKTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "RedBlackTree.h"
+
+template< typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T> >
+class ShardedRedBlackTree {
+public:
+	//type definitions
+	typedef RedBlackTree<T, Allocator, OrderStatistics, Compare> treeType;
+	typedef T value_type;
+	typedef Compare key_compare;
+	typedef Allocator allocator_type;
+
+	//shards are written by different threads but move nodes between each other, so they need one allocator without shared state
+	static_assert(std::allocator_traits<Allocator>::is_always_equal::value, "shards allocate concurrently, the allocator must be stateless (not RedBlackNodePool)");
+
+	class const_iterator;
+
+	//constructor
+	//shards are added by splitting the first shard that grows over splitSize, later a shard over 1.5 times the size of a neighbour (plus splitSize) gives half of the difference to it
+	explicit ShardedRedBlackTree(size_t shardCount = 16, size_t splitSize = 4096, const key_compare& compare = key_compare(), const allocator_type& alloc = allocator_type())
+		: shards(new Shard[shardCount]), shardCount(shardCount), splitSize(splitSize), comp(compare) {
+		for (size_t i = 0; i < shardCount; i++) {
+			shards[i].tree = treeType(compare, alloc);
+		}
+		Routing* first = new Routing();
+		first->versions.assign(shardCount, 0);
+		routings.push_back(std::unique_ptr<Routing>(first));
+		routing.store(first);
+	}
+
+	ShardedRedBlackTree(const ShardedRedBlackTree&) = delete;
+	ShardedRedBlackTree& operator=(const ShardedRedBlackTree&) = delete;
+
+	size_t size() const {
+		//exact while no other thread changes the tree
+		size_t result = 0;
+		for (size_t i = 0; i < shardCount; i++) {
+			result += shards[i].count.load(std::memory_order_relaxed);
+		}
+		return result;
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+	size_t shard_count() const {
+		return shardCount;
+	}
+
+	size_t shard_size(size_t shard) const {
+		return shards[shard].count.load(std::memory_order_relaxed);
+	}
+
+	void insert(const value_type& val) {
+		size_t index = lockShard(val);
+		Shard& shard = shards[index];
+		shard.tree.insert(val);
+		size_t count = shard.tree.size();
+		shard.count.store(count, std::memory_order_relaxed);
+		shard.lock.unlock();
+
+		//the load of the neighbours is checked every 256 inserts
+		if (count % 256 == 0 && overloaded(index, count)) {
+			rebalance(index);
+		}
+	}
+
+	void erase(const value_type& val) {
+		size_t index = lockShard(val);
+		Shard& shard = shards[index];
+		shard.tree.erase(val);
+		shard.count.store(shard.tree.size(), std::memory_order_relaxed);
+		shard.lock.unlock();
+	}
+
+	bool contains(const value_type& val) {
+		size_t index = lockShard(val);
+		bool found = shards[index].tree.find(val) != NULL;
+		shards[index].lock.unlock();
+		return found;
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> guard(rebalanceLock);
+		for (size_t i = 0; i < shardCount; i++) {
+			std::lock_guard<std::mutex> shardGuard(shards[i].lock);
+			shards[i].tree.clear();
+			shards[i].count.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	template <typename Visitor>
+	void for_each(Visitor visitor) {
+		//calls visitor(value) for all values in order, every shard is locked while it is visited
+		//boundaries don't move meanwhile, so every value stays in one shard
+		std::lock_guard<std::mutex> guard(rebalanceLock);
+		for (size_t i = 0; i < shardCount; i++) {
+			std::lock_guard<std::mutex> shardGuard(shards[i].lock);
+			shards[i].tree.for_each(visitor);
+		}
+	}
+
+	//shards hold consecutive key ranges, so iterating the shards one after another gives all values in order
+	//iterators take no locks, no other thread may change the tree while they are used
+	const_iterator begin() const {
+		return const_iterator(shards.get(), 0, shardCount);
+	}
+
+	const_iterator end() const {
+		return const_iterator(shards.get(), shardCount, shardCount);
+	}
+
+private:
+
+	struct alignas(64) Shard {
+		//tree and version are guarded by lock, count mirrors tree.size() for other threads
+		std::mutex lock;
+		treeType tree;
+		std::atomic<size_t> count;
+		size_t version;
+
+		Shard() : count(0), version(0) {}
+	};
+
+	struct Routing {
+		//shard i holds values in [bounds[i - 1], bounds[i]), shards after bounds.size() are not used yet
+		//a published routing never changes, versions tell whether a shard still has the range from this routing
+		std::vector<T> bounds;
+		std::vector<size_t> versions;
+	};
+
+	std::unique_ptr<Shard[]> shards;
+	size_t shardCount;
+	size_t splitSize;
+	key_compare comp;
+
+	//routings are kept until the tree is destroyed, readers of an old one may still be running
+	std::atomic<const Routing*> routing;
+	std::vector<std::unique_ptr<Routing> > routings;
+	std::mutex rebalanceLock;
+
+	template <typename A, typename B>
+	bool lessThan(const A& a, const B& b) const {
+		return lessHelp(a, b, isThreeWay<Compare>());
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::false_type) const {
+		return comp(a, b);
+	}
+
+	template <typename A, typename B>
+	bool lessHelp(const A& a, const B& b, std::true_type) const {
+		return comp(a, b) < 0;
+	}
+
+	size_t lockShard(const value_type& val) {
+		//returns index of the locked shard holding val, retries if a rebalance moved the range meanwhile
+		while (true) {
+			const Routing* current = routing.load(std::memory_order_acquire);
+			size_t index = 0;
+			for (size_t step = current->bounds.size(); step > 0;) {
+				//upper bound: number of bounds <= val
+				size_t half = step / 2;
+				if (!lessThan(val, current->bounds[index + half])) {
+					index += half + 1;
+					step -= half + 1;
+				}
+				else {
+					step = half;
+				}
+			}
+			shards[index].lock.lock();
+			if (shards[index].version == current->versions[index]) {
+				return index;
+			}
+			shards[index].lock.unlock();
+		}
+	}
+
+	bool overloaded(size_t index, size_t count) const {
+		const Routing* current = routing.load(std::memory_order_acquire);
+		size_t used = current->bounds.size() + 1;
+		if (used < shardCount) {
+			return count > splitSize;
+		}
+		size_t neighbour = (index + 1 < used) ? shard_size(index + 1) : count;
+		if (index > 0) {
+			neighbour = std::min(neighbour, shard_size(index - 1));
+		}
+		return count > neighbour + neighbour / 2 + splitSize;
+	}
+
+	void rebalance(size_t index) {
+		//operations routed to a changed shard retry until the new routing is published
+		std::lock_guard<std::mutex> guard(rebalanceLock);
+		size_t used = routing.load(std::memory_order_relaxed)->bounds.size() + 1;
+		if (used < shardCount) {
+			Routing* next = new Routing(*routing.load(std::memory_order_relaxed));
+			if (splitShard(index, used, *next)) {
+				publishRouting(next);
+			}
+			else {
+				delete next;
+			}
+			return;
+		}
+
+		//a move can overload the neighbour, then the moves go on from there
+		while (true) {
+			Routing* next = new Routing(*routing.load(std::memory_order_relaxed));
+			if (!moveToNeighbour(index, used, *next)) {
+				delete next;
+				return;
+			}
+			publishRouting(next);
+		}
+	}
+
+	void publishRouting(Routing* next) {
+		routings.push_back(std::unique_ptr<Routing>(next));
+		routing.store(next, std::memory_order_release);
+	}
+
+	bool splitShard(size_t index, size_t used, Routing& next) {
+		//the upper half of shard index goes to a new shard index + 1, the following shards move one place up
+		std::vector<std::unique_lock<std::mutex> > locks;
+		for (size_t i = index; i <= used; i++) {
+			locks.push_back(std::unique_lock<std::mutex>(shards[i].lock));
+		}
+		treeType& tree = shards[index].tree;
+		size_t count = tree.size();
+		if (count <= splitSize) {
+			return false;
+		}
+		value_type key = *tree.select(count / 2);
+		if (!lessThan(*tree.begin(), key)) {
+			//the lower half are all equal values, they can't be split
+			return false;
+		}
+
+		for (size_t i = used; i > index + 1; i--) {
+			shards[i].tree = std::move(shards[i - 1].tree);
+			publish(i, next);
+		}
+		std::pair<treeType, treeType> halves = tree.split(key);
+		tree = std::move(halves.first);
+		shards[index + 1].tree = std::move(halves.second);
+		publish(index, next);
+		publish(index + 1, next);
+		next.bounds.insert(next.bounds.begin() + index, key);
+		return true;
+	}
+
+	bool moveToNeighbour(size_t& index, size_t used, Routing& next) {
+		//half of the difference goes to the smaller neighbour, the boundary between them moves, index becomes the neighbour
+		size_t neighbour = (index + 1 < used) ? index + 1 : index - 1;
+		if (index > 0 && index + 1 < used && shard_size(index - 1) < shard_size(index + 1)) {
+			neighbour = index - 1;
+		}
+		std::unique_lock<std::mutex> lowerLock(shards[std::min(index, neighbour)].lock);
+		std::unique_lock<std::mutex> upperLock(shards[std::max(index, neighbour)].lock);
+		treeType& tree = shards[index].tree;
+		treeType& target = shards[neighbour].tree;
+		size_t count = tree.size();
+		if (count <= target.size() + target.size() / 2 + splitSize) {
+			return false;
+		}
+		size_t moved = (count - target.size()) / 2;
+
+		value_type key = *tree.select((neighbour > index) ? count - moved : moved);
+		if (!lessThan(*tree.begin(), key)) {
+			return false;
+		}
+		std::pair<treeType, treeType> halves = tree.split(key);
+		if (neighbour > index) {
+			tree = std::move(halves.first);
+			halves.second.join(std::move(target));
+			target = std::move(halves.second);
+			next.bounds[index] = key;
+		}
+		else {
+			target.join(std::move(halves.first));
+			tree = std::move(halves.second);
+			next.bounds[neighbour] = key;
+		}
+		publish(index, next);
+		publish(neighbour, next);
+		index = neighbour;
+		return true;
+	}
+
+	void publish(size_t index, Routing& next) {
+		//called with the shard locked, operations routed by an older routing will retry
+		shards[index].version++;
+		shards[index].count.store(shards[index].tree.size(), std::memory_order_relaxed);
+		next.versions[index] = shards[index].version;
+	}
+
+public:
+
+	class const_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef T value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const T* pointer;
+		typedef const T& reference;
+
+		const_iterator() : shards(NULL), index(0), last(0) {}
+
+		const T& operator*() const {
+			return *current;
+		}
+
+		const T* operator->() const {
+			return &*current;
+		}
+
+		const_iterator& operator++() {
+			++current;
+			skipEmpty();
+			return *this;
+		}
+
+		const_iterator operator++(int) {
+			const_iterator result = *this;
+			++*this;
+			return result;
+		}
+
+		bool operator==(const const_iterator& that) const {
+			return index == that.index && (index == last || current == that.current);
+		}
+
+		bool operator!=(const const_iterator& that) const {
+			return !(*this == that);
+		}
+
+	private:
+		friend class ShardedRedBlackTree;
+
+		const Shard* shards;
+		size_t index;
+		size_t last;
+		typename treeType::const_iterator current;
+
+		const_iterator(const Shard* shards, size_t index, size_t last) : shards(shards), index(index), last(last) {
+			if (index < last) {
+				current = shards[index].tree.begin();
+				skipEmpty();
+			}
+		}
+
+		void skipEmpty() {
+			//move to the next shard at the end of a shard
+			while (index < last && current == shards[index].tree.end()) {
+				index++;
+				if (index < last) {
+					current = shards[index].tree.begin();
+				}
+			}
+		}
+	};
+
+};
+
+#endif
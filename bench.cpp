@@ -0,0 +1,1168 @@
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "RedBlackTree.h"
+#include "FrozenRedBlackTree.h"
+#include "PersistentRedBlackTree.h"
+#include "ShardedRedBlackTree.h"
+#include "MappedRedBlackTree.h"
+
+typedef std::chrono::steady_clock benchClock;
+
+double elapsed_ns(benchClock::time_point start, size_t operations)
+{
+    return std::chrono::duration<double, std::nano>(benchClock::now() - start).count() / operations;
+}
+
+std::vector<int> random_values(size_t count, unsigned seed)
+{
+    std::vector<int> values(count);
+    srand(seed);
+    for (size_t i = 0; i < count; i++)
+    {
+        values[i] = rand();
+    }
+    return values;
+}
+
+template <typename Tree>
+double bench_insert_heavy(const std::vector<int>& values)
+{
+    // Build the tree once, then throw it away and build it again in the same tree object
+    Tree tree;
+    benchClock::time_point start = benchClock::now();
+    for (size_t round = 0; round < 4; round++)
+    {
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            tree.insert(values[i]);
+        }
+        tree.clear();
+    }
+    return elapsed_ns(start, 4 * values.size());
+}
+
+template <typename Tree>
+double bench_erase_heavy(const std::vector<int>& values)
+{
+    // Keep a steady-state tree and replace one element per step (erase old, insert new)
+    Tree tree;
+    size_t window = values.size() / 4;
+    for (size_t i = 0; i < window; i++)
+    {
+        tree.insert(values[i]);
+    }
+
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = window; i < values.size(); i++)
+    {
+        tree.erase(values[i - window]);
+        tree.insert(values[i]);
+    }
+    double result = elapsed_ns(start, values.size() - window);
+    tree.clear();
+    return result;
+}
+
+void bench_allocators(size_t element_count)
+{
+    std::vector<int> values = random_values(element_count, 42);
+
+    std::cout << "Allocators, " << element_count << " elements (ns/op)" << std::endl;
+    std::cout << "  insert-heavy\tnew/delete: " << bench_insert_heavy<RedBlackTree<int> >(values);
+    std::cout << "\tpool: " << bench_insert_heavy<RedBlackTree<int, RedBlackNodePool<int> > >(values) << std::endl;
+    std::cout << "  erase-heavy\tnew/delete: " << bench_erase_heavy<RedBlackTree<int> >(values);
+    std::cout << "\tpool: " << bench_erase_heavy<RedBlackTree<int, RedBlackNodePool<int> > >(values) << std::endl;
+}
+
+double bench_set_union(const std::vector<int>& values, size_t grain)
+{
+    // Two trees with overlapping key ranges (even and odd positions of the same random sequence)
+    std::vector<int> values1, values2;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        (i % 2 == 0 ? values1 : values2).push_back(values[i]);
+    }
+    std::sort(values1.begin(), values1.end());
+    std::sort(values2.begin(), values2.end());
+
+    RedBlackTree<int> tree1(values1.begin(), values1.end());
+    RedBlackTree<int> tree2(values2.begin(), values2.end());
+
+    benchClock::time_point start = benchClock::now();
+    tree1.set_union(std::move(tree2), grain);
+    double result = elapsed_ns(start, values.size());
+    tree1.clear();
+    return result;
+}
+
+void bench_set_operations(size_t element_count)
+{
+    std::vector<int> values = random_values(element_count, 42);
+
+    std::cout << "Set union, " << element_count << " elements (ns/element)" << std::endl;
+    std::cout << "  sequential: " << bench_set_union(values, (size_t)-1);
+    std::cout << "\tparallel (grain 4096): " << bench_set_union(values, 4096) << std::endl;
+}
+
+std::vector<int> near_monotone_values(size_t count, int jitter, unsigned seed)
+{
+    // Increasing sequence where every value may arrive up to jitter positions late
+    std::vector<int> values(count);
+    srand(seed);
+    for (size_t i = 0; i < count; i++)
+    {
+        values[i] = (int)i + ((jitter > 0) ? rand() % jitter : 0);
+    }
+    return values;
+}
+
+template <typename Tree>
+double bench_plain_insert(const std::vector<int>& values)
+{
+    // The first round only warms up the allocator, the second one is measured
+    Tree tree;
+    double result = 0;
+    for (size_t round = 0; round < 2; round++)
+    {
+        benchClock::time_point start = benchClock::now();
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            tree.insert(values[i]);
+        }
+        result = elapsed_ns(start, values.size());
+        tree.clear();
+    }
+    return result;
+}
+
+template <typename Tree>
+double bench_hinted_insert(const std::vector<int>& values)
+{
+    // The hint is the position after the previously inserted value
+    Tree tree;
+    double result = 0;
+    for (size_t round = 0; round < 2; round++)
+    {
+        typename Tree::iterator hint = tree.end();
+        benchClock::time_point start = benchClock::now();
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            hint = tree.insert(hint, values[i]);
+            ++hint;
+        }
+        result = elapsed_ns(start, values.size());
+        tree.clear();
+    }
+    return result;
+}
+
+void bench_sorted_streams(size_t element_count)
+{
+    std::cout << "Nearly sorted insert, " << element_count << " elements (ns/op)" << std::endl;
+    int jitters[] = { 0, 4, 64 };
+    for (int jitter : jitters)
+    {
+        std::vector<int> values = near_monotone_values(element_count, jitter, 42);
+        std::cout << "  jitter " << jitter << "\tinsert: " << bench_plain_insert<RedBlackTree<int> >(values);
+        std::cout << "\thinted: " << bench_hinted_insert<RedBlackTree<int> >(values);
+        std::cout << "\tstd::multiset: " << bench_plain_insert<std::multiset<int> >(values);
+        std::cout << "\tstd::multiset hinted: " << bench_hinted_insert<std::multiset<int> >(values) << std::endl;
+    }
+}
+
+template <typename T>
+void pop_min(RedBlackTree<T>& tree)
+{
+    tree.pop_min();
+}
+
+template <typename T>
+void pop_min(std::multiset<T>& tree)
+{
+    tree.erase(tree.begin());
+}
+
+template <typename Tree>
+double bench_priority_queue(const std::vector<int>& values)
+{
+    // Steady-state queue of values.size() / 4 elements: take the minimum, push a new value
+    Tree tree;
+    size_t window = values.size() / 4;
+    for (size_t i = 0; i < window; i++)
+    {
+        tree.insert(values[i]);
+    }
+
+    long long checksum = 0;
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = window; i < values.size(); i++)
+    {
+        checksum += *tree.begin();
+        pop_min(tree);
+        tree.insert(values[i]);
+    }
+    double result = elapsed_ns(start, values.size() - window);
+    if (checksum == 42) {
+        std::cout << "";
+    }
+    tree.clear();
+    return result;
+}
+
+void bench_priority_queues(size_t element_count)
+{
+    std::vector<int> values = random_values(element_count, 42);
+
+    std::cout << "Priority queue, " << element_count / 4 << " elements (ns/op)" << std::endl;
+    std::cout << "  pop_min + insert\tRedBlackTree: " << bench_priority_queue<RedBlackTree<int> >(values);
+    std::cout << "\tstd::multiset: " << bench_priority_queue<std::multiset<int> >(values) << std::endl;
+}
+
+template <typename Tree>
+double bench_iterator_scan(const Tree& tree, size_t element_count)
+{
+    // Million elements per second of a full in-order scan with iterators
+    long long sum = 0;
+    benchClock::time_point start = benchClock::now();
+    for (typename Tree::const_iterator it = tree.begin(); it != tree.end(); ++it)
+    {
+        sum += *it;
+    }
+    double result = 1e3 / elapsed_ns(start, element_count);
+    if (sum == 42) {
+        std::cout << "";
+    }
+    return result;
+}
+
+double bench_for_each_scan(RedBlackTree<int>& tree, size_t element_count)
+{
+    long long sum = 0;
+    benchClock::time_point start = benchClock::now();
+    tree.for_each([&sum](int value) { sum += value; });
+    double result = 1e3 / elapsed_ns(start, element_count);
+    if (sum == 42) {
+        std::cout << "";
+    }
+    return result;
+}
+
+void bench_scans(size_t element_count)
+{
+    std::vector<int> values = random_values(element_count, 42);
+    RedBlackTree<int> tree;
+    std::multiset<int> reference;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        tree.insert(values[i]);
+        reference.insert(values[i]);
+    }
+
+    std::cout << "Full scan, " << element_count << " elements (M elements/s)" << std::endl;
+    std::cout << "  iterator: " << bench_iterator_scan(tree, element_count);
+    std::cout << "\tfor_each: " << bench_for_each_scan(tree, element_count);
+    std::cout << "\tstd::multiset: " << bench_iterator_scan(reference, element_count) << std::endl;
+    tree.clear();
+}
+
+size_t heap_bytes()
+{
+    // Bytes currently allocated from the heap (only known with glibc)
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+template <typename Tree>
+void bench_layout_memory(const char* name, size_t element_count)
+{
+    size_t before = heap_bytes();
+    Tree tree;
+    for (size_t i = 0; i < element_count; i++)
+    {
+        tree.insert((typename Tree::value_type)i);
+    }
+    size_t after = heap_bytes();
+
+    // Lookups of random present keys show the cost of decoding the links
+    std::vector<int> keys = random_values(element_count, 7);
+    size_t found = 0;
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        found += (tree.find((typename Tree::value_type)(keys[i] % element_count)) != NULL);
+    }
+    double lookup = elapsed_ns(start, keys.size());
+
+    std::cout << "  " << name << "\tnode: " << sizeof(typename Tree::nodeType) << " B";
+    std::cout << "\theap: " << (double)(after - before) / element_count << " B/element";
+    std::cout << "\tfind: " << lookup << " ns/op" << (found == keys.size() ? "" : " (lookup error)") << std::endl;
+    tree.clear();
+}
+
+void bench_memory(size_t element_count)
+{
+    std::cout << "Memory, " << element_count << " elements" << std::endl;
+    bench_layout_memory<RedBlackTree<int> >("int, pointers", element_count);
+    bench_layout_memory<RedBlackTree<int, std::allocator<int>, CompactColor> >("int, compact colour", element_count);
+    bench_layout_memory<RedBlackTree<int, std::allocator<int>, IndexLinks> >("int, 32-bit indices", element_count);
+    bench_layout_memory<RedBlackTree<long long> >("int64, pointers", element_count);
+    bench_layout_memory<RedBlackTree<long long, std::allocator<long long>, CompactColor> >("int64, compact colour", element_count);
+    bench_layout_memory<RedBlackTree<long long, std::allocator<long long>, IndexLinks> >("int64, 32-bit indices", element_count);
+}
+
+template <typename Lookup>
+double bench_lookups(const std::vector<int>& keys, Lookup lookup)
+{
+    // Million lookups per second, the checksum keeps the lookups from being optimized away
+    long long checksum = 0;
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        checksum += lookup(keys[i]);
+    }
+    double result = 1e3 / elapsed_ns(start, keys.size());
+    if (checksum == 42) {
+        std::cout << "";
+    }
+    return result;
+}
+
+void bench_frozen(size_t element_count)
+{
+    // Even keys are stored, half of the lookups miss
+    RedBlackTree<int> tree;
+    RedBlackTree<int>::iterator hint = tree.end();
+    for (size_t i = 0; i < element_count; i++)
+    {
+        hint = tree.insert(hint, (int)(2 * i));
+        ++hint;
+    }
+    FrozenRedBlackTree<int> frozen = tree.freeze();
+    std::vector<int> sorted(tree.begin(), tree.end());
+
+    std::vector<int> keys = random_values(1000000, 7);
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        keys[i] %= (int)(2 * element_count - 1);
+    }
+
+    std::cout << "Lookups, " << element_count << " elements (M lookups/s)" << std::endl;
+    std::cout << "  lower_bound	tree: " << bench_lookups(keys, [&tree](int key) { return *tree.lower_bound(key); });
+    std::cout << "	frozen: " << bench_lookups(keys, [&frozen](int key) { return *frozen.lower_bound(key); });
+    std::cout << "	sorted vector: " << bench_lookups(keys, [&sorted](int key) { return *std::lower_bound(sorted.begin(), sorted.end(), key); }) << std::endl;
+    std::cout << "  find	tree: " << bench_lookups(keys, [&tree](int key) { return tree.find(key) != NULL; });
+    std::cout << "	frozen: " << bench_lookups(keys, [&frozen](int key) { return frozen.find(key) != NULL; }) << std::endl;
+    tree.clear();
+}
+
+void bench_find_batches(size_t element_count)
+{
+    // Random inserts scatter the nodes in memory, so every level of a lookup is likely a cache miss
+    std::vector<int> values = random_values(element_count, 42);
+    RedBlackTree<int> tree;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        tree.insert(values[i]);
+    }
+    std::vector<int> keys = random_values(1000000, 7);
+    for (size_t i = 0; i < keys.size(); i += 2)
+    {
+        keys[i] = values[keys[i] % values.size()];
+    }
+
+    std::cout << "Batched find, " << element_count << " elements (M lookups/s)" << std::endl;
+    std::cout << "  single find: " << bench_lookups(keys, [&tree](int key) { return tree.find(key) != NULL; }) << std::endl;
+    size_t batches[] = { 1, 4, 16, 64, 256, 1024 };
+    std::vector<RedBlackTree<int>::nodeType*> found(1024);
+    for (size_t batch : batches)
+    {
+        long long checksum = 0;
+        benchClock::time_point start = benchClock::now();
+        for (size_t i = 0; i < keys.size(); i += batch)
+        {
+            size_t count = std::min(batch, keys.size() - i);
+            tree.find_batch(keys.begin() + i, keys.begin() + i + count, found.begin());
+            for (size_t j = 0; j < count; j++)
+            {
+                checksum += (found[j] != NULL);
+            }
+        }
+        std::cout << "  batch " << batch << ": " << 1e3 / elapsed_ns(start, keys.size()) << (checksum == 42 ? " " : "") << std::endl;
+    }
+    tree.clear();
+}
+
+struct SnapshotResult
+{
+    double writer_ns;
+    double reader_meps;
+};
+
+template <typename Writer, typename Reader>
+SnapshotResult bench_readers_writer(size_t write_count, size_t reader_count, Writer writer, Reader reader)
+{
+    // Readers scan the whole tree again and again until the writer is done
+    std::atomic<bool> done(false);
+    std::atomic<size_t> scanned(0);
+    std::vector<std::thread> readers;
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = 0; i < reader_count; i++)
+    {
+        readers.push_back(std::thread([&]() {
+            while (!done.load()) {
+                scanned += reader();
+            }
+        }));
+    }
+    for (size_t i = 0; i < write_count; i++)
+    {
+        writer(i);
+    }
+    SnapshotResult result;
+    result.writer_ns = elapsed_ns(start, write_count);
+    done = true;
+    for (size_t i = 0; i < readers.size(); i++)
+    {
+        readers[i].join();
+    }
+    result.reader_meps = 1e3 / elapsed_ns(start, scanned.load() + 1);
+    return result;
+}
+
+void bench_snapshots(size_t element_count, size_t reader_count)
+{
+    std::vector<int> values = random_values(element_count + element_count / 4, 42);
+    size_t write_count = element_count / 4;
+
+    // Mutex-protected tree: a scan holds the lock, so the writer waits for it
+    RedBlackTree<int> locked;
+    std::mutex treeLock;
+    for (size_t i = 0; i < element_count; i++)
+    {
+        locked.insert(values[i]);
+    }
+    SnapshotResult mutexResult = bench_readers_writer(write_count, reader_count,
+        [&](size_t i) { std::lock_guard<std::mutex> guard(treeLock); locked.insert(values[element_count + i]); },
+        [&]() { size_t count = 0; std::lock_guard<std::mutex> guard(treeLock); locked.for_each([&count](int) { count++; }); return count; });
+    locked.clear();
+
+    // Persistent tree: the writer publishes a snapshot every 64 inserts, the lock only guards the O(1) swap
+    PersistentRedBlackTree<int> tree;
+    PersistentRedBlackTree<int> published;
+    std::mutex publishLock;
+    for (size_t i = 0; i < element_count; i++)
+    {
+        tree.insert(values[i]);
+    }
+    published = tree.snapshot();
+    SnapshotResult persistentResult = bench_readers_writer(write_count, reader_count,
+        [&](size_t i) {
+            tree.insert(values[element_count + i]);
+            if (i % 64 == 0) {
+                PersistentRedBlackTree<int> snapshot = tree.snapshot();
+                std::lock_guard<std::mutex> guard(publishLock);
+                std::swap(snapshot, published);
+            }
+        },
+        [&]() {
+            PersistentRedBlackTree<int> snapshot;
+            {
+                std::lock_guard<std::mutex> guard(publishLock);
+                snapshot = published;
+            }
+            size_t count = 0;
+            snapshot.for_each([&count](int) { count++; });
+            return count;
+        });
+    published.clear();
+    tree.clear();
+
+    std::cout << "Snapshots, " << element_count << " elements, " << write_count << " inserts, " << reader_count << " readers" << std::endl;
+    std::cout << "  mutex + RedBlackTree\twriter: " << mutexResult.writer_ns << " ns/insert\treaders: " << mutexResult.reader_meps << " M elements/s" << std::endl;
+    std::cout << "  PersistentRedBlackTree\twriter: " << persistentResult.writer_ns << " ns/insert\treaders: " << persistentResult.reader_meps << " M elements/s" << std::endl;
+}
+
+void bench_persistent_writer(size_t element_count)
+{
+    // Writer cost alone: in place while nothing is shared, path copying while snapshots are kept
+    std::vector<int> values = random_values(element_count, 42);
+    std::cout << "Persistent writer, " << element_count << " inserts (ns/op)" << std::endl;
+    std::cout << "  RedBlackTree: " << bench_plain_insert<RedBlackTree<int> >(values);
+    std::cout << "\tPersistentRedBlackTree: " << bench_plain_insert<PersistentRedBlackTree<int> >(values);
+
+    PersistentRedBlackTree<int> tree;
+    std::vector<PersistentRedBlackTree<int> > snapshots;
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        tree.insert(values[i]);
+        if (i % 64 == 0) {
+            snapshots.push_back(tree.snapshot());
+        }
+    }
+    std::cout << "\tsnapshot every 64: " << elapsed_ns(start, values.size()) << std::endl;
+}
+
+template <typename Insert>
+double bench_parallel_insert(const std::vector<int>& values, size_t thread_count, Insert insert)
+{
+    // Million inserts per second, every thread inserts its own slice of values
+    std::vector<std::thread> threads;
+    benchClock::time_point start = benchClock::now();
+    for (size_t t = 0; t < thread_count; t++)
+    {
+        threads.push_back(std::thread([&values, &insert, t, thread_count]() {
+            for (size_t i = t; i < values.size(); i += thread_count)
+            {
+                insert(values[i]);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+    return 1e3 / elapsed_ns(start, values.size());
+}
+
+void bench_sharded(size_t element_count)
+{
+    std::vector<int> values = random_values(element_count, 42);
+    std::cout << "Parallel insert, " << element_count << " uniform values, " << std::thread::hardware_concurrency() << " hardware threads (M inserts/s)" << std::endl;
+    size_t threads[] = { 1, 2, 4, 8, 16, 32 };
+    for (size_t thread_count : threads)
+    {
+        RedBlackTree<int> locked;
+        std::mutex treeLock;
+        std::cout << "  " << thread_count << " threads\tmutex + RedBlackTree: " << bench_parallel_insert(values, thread_count, [&](int value) { std::lock_guard<std::mutex> guard(treeLock); locked.insert(value); });
+        locked.clear();
+
+        ShardedRedBlackTree<int> sharded(32);
+        std::cout << "\tShardedRedBlackTree (32 shards): " << bench_parallel_insert(values, thread_count, [&](int value) { sharded.insert(value); }) << std::endl;
+    }
+}
+
+void bench_batches(size_t element_count)
+{
+    // Keys are added to (and then removed from) a tree of element_count random values
+    std::vector<int> base = random_values(element_count, 42);
+    std::sort(base.begin(), base.end());
+    std::vector<int> keys = random_values(element_count / 2, 7);
+
+    std::cout << "Batch insert/erase, " << element_count << " elements, " << keys.size() << " keys (ns/key)" << std::endl;
+    RedBlackTree<int> tree(base.begin(), base.end());
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        tree.insert(keys[i]);
+    }
+    std::cout << "  single\tinsert: " << elapsed_ns(start, keys.size());
+    start = benchClock::now();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        tree.erase(keys[i]);
+    }
+    std::cout << "\terase: " << elapsed_ns(start, keys.size()) << std::endl;
+    tree.clear();
+
+    size_t batches[] = { 100, 1000, 10000, 100000, 500000 };
+    for (size_t batch : batches)
+    {
+        for (size_t grain : { (size_t)-1, (size_t)4096 })
+        {
+            tree.assign(base.begin(), base.end());
+            start = benchClock::now();
+            for (size_t i = 0; i < keys.size(); i += batch)
+            {
+                tree.insert_batch(keys.begin() + i, keys.begin() + std::min(i + batch, keys.size()), grain);
+            }
+            std::cout << "  batch " << batch << (grain == (size_t)-1 ? " finger search" : " split/join, grain 4096") << "\tinsert: " << elapsed_ns(start, keys.size());
+            start = benchClock::now();
+            for (size_t i = 0; i < keys.size(); i += batch)
+            {
+                tree.erase_batch(keys.begin() + i, keys.begin() + std::min(i + batch, keys.size()), grain);
+            }
+            std::cout << "\terase: " << elapsed_ns(start, keys.size()) << std::endl;
+            tree.clear();
+        }
+    }
+}
+
+void bench_expire(size_t element_count)
+{
+    // A sliding window of timestamps, the oldest tenth expires at a time
+    std::cout << "Expiring old entries, " << element_count << " elements (ns/element)" << std::endl;
+    size_t step = element_count / 10;
+    for (int method = 0; method < 2; method++)
+    {
+        RedBlackTree<long long> tree;
+        for (size_t i = 0; i < element_count; i++)
+        {
+            tree.insert((long long)i);
+        }
+        benchClock::time_point start = benchClock::now();
+        for (size_t cutoff = step; cutoff <= element_count; cutoff += step)
+        {
+            if (method == 0) {
+                for (long long time = (long long)(cutoff - step); time < (long long)cutoff; time++)
+                {
+                    tree.erase(time);
+                }
+            }
+            else {
+                tree.erase(tree.begin(), tree.lower_bound((long long)cutoff));
+            }
+        }
+        std::cout << (method == 0 ? "  erase(value)" : "  erase(first, last)") << ": " << elapsed_ns(start, element_count) << std::endl;
+    }
+}
+
+void bench_stats(size_t element_count)
+{
+    // Cost of counting and timing every operation, the instrumented tree prints its stats afterwards
+    std::vector<int> values = random_values(element_count, 42);
+    std::cout << "Instrumentation, " << element_count << " elements (ns/op)" << std::endl;
+    std::cout << "  plain\tinsert/clear: " << bench_insert_heavy<RedBlackTree<int> >(values) << "\terase/insert: " << bench_erase_heavy<RedBlackTree<int> >(values) << std::endl;
+    std::cout << "  instrumented\tinsert/clear: " << bench_insert_heavy<RedBlackTree<int, std::allocator<int>, Instrumented> >(values);
+    std::cout << "\terase/insert: " << bench_erase_heavy<RedBlackTree<int, std::allocator<int>, Instrumented> >(values) << std::endl;
+
+    RedBlackTree<int, std::allocator<int>, Instrumented> tree;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        tree.insert(values[i]);
+    }
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        tree.find(values[values.size() - 1 - i]);
+    }
+    std::cout << "  " << tree.stats().to_json() << std::endl;
+}
+
+void bench_build_parallel(size_t element_count)
+{
+    std::vector<int> values = random_values(element_count, 42);
+    std::cout << "Construction from unsorted values, " << element_count << " elements, " << std::thread::hardware_concurrency() << " hardware threads (ns/element)" << std::endl;
+
+    RedBlackTree<int> tree;
+    benchClock::time_point start = benchClock::now();
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        tree.insert(values[i]);
+    }
+    std::cout << "  insert: " << elapsed_ns(start, values.size());
+    tree.clear();
+
+    // The first build only warms up the allocator
+    tree.build_parallel(values.begin(), values.end(), 1);
+    tree.clear();
+    unsigned threads[] = { 1, 2, 4, 8 };
+    for (unsigned thread_count : threads)
+    {
+        start = benchClock::now();
+        tree.build_parallel(values.begin(), values.end(), thread_count);
+        std::cout << "\tbuild_parallel(" << thread_count << "): " << elapsed_ns(start, values.size());
+        tree.clear();
+    }
+    std::cout << std::endl;
+}
+
+void bench_mapped(size_t element_count)
+{
+    // Startup from an image against rebuilding by inserts, then lookups in both
+    std::vector<int> values = random_values(element_count, 42);
+    const std::string path = "bench_mapped.image";
+    std::cout << "Mapped image, " << element_count << " elements" << std::endl;
+
+    benchClock::time_point start = benchClock::now();
+    RedBlackTree<int> tree;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        tree.insert(values[i]);
+    }
+    std::cout << "  rebuild by insert: " << elapsed_ns(start, 1000000) << " ms";
+    start = benchClock::now();
+    tree.save(path);
+    std::cout << "\tsave: " << elapsed_ns(start, 1000000) << " ms";
+    for (bool verify : { false, true })
+    {
+        start = benchClock::now();
+        MappedRedBlackTree<int> mapped = RedBlackTree<int>::load_mapped(path, verify);
+        std::cout << (verify ? "\tload, checksum: " : "\tload: ") << elapsed_ns(start, 1000000) << " ms";
+    }
+    std::cout << std::endl;
+
+    MappedRedBlackTree<int> mapped = RedBlackTree<int>::load_mapped(path);
+    std::cout << "  find (M lookups/s)\ttree: " << bench_lookups(values, [&tree](int key) { return tree.find(key) != NULL; });
+    std::cout << "\tmapped: " << bench_lookups(values, [&mapped](int key) { return mapped.find(key) != NULL; }) << std::endl;
+    std::remove(path.c_str());
+}
+
+// Workload suite: RedBlackTree against std::multiset for every key type, size and access pattern
+
+class PerfCounters {
+    // Cache and branch misses of this thread (perf_event_open, Linux only), available() is false where perf events are not allowed
+public:
+    PerfCounters()
+    {
+        descriptors[0] = open(PERF_COUNT_HW_CACHE_MISSES);
+        descriptors[1] = open(PERF_COUNT_HW_BRANCH_MISSES);
+    }
+
+    ~PerfCounters()
+    {
+#if defined(__linux__)
+        for (int descriptor : descriptors)
+        {
+            if (descriptor >= 0) {
+                close(descriptor);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const
+    {
+        return descriptors[0] >= 0 && descriptors[1] >= 0;
+    }
+
+    void start()
+    {
+#if defined(__linux__)
+        for (int descriptor : descriptors)
+        {
+            if (descriptor >= 0) {
+                ioctl(descriptor, PERF_EVENT_IOC_RESET, 0);
+                ioctl(descriptor, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop(double& cache_misses, double& branch_misses)
+    {
+        // adds the events since start()
+        cache_misses += read(descriptors[0]);
+        branch_misses += read(descriptors[1]);
+    }
+
+private:
+    int descriptors[2];
+
+#if !defined(__linux__)
+    enum { PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+#endif
+
+    static int open(unsigned long long config)
+    {
+#if defined(__linux__)
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = config;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        return (int)syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+#else
+        (void)config;
+        return -1;
+#endif
+    }
+
+    static double read(int descriptor)
+    {
+#if defined(__linux__)
+        long long count = 0;
+        if (descriptor >= 0) {
+            ioctl(descriptor, PERF_EVENT_IOC_DISABLE, 0);
+            if (::read(descriptor, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+        return (double)count;
+#else
+        (void)descriptor;
+        return 0;
+#endif
+    }
+};
+
+class ZipfGenerator {
+    // Ranks in [0, n) with probability proportional to 1 / (rank + 1)^theta
+    // (Gray et al., "Quickly generating billion-record synthetic databases", the same as YCSB)
+public:
+    ZipfGenerator(size_t n, double theta) : n(n), theta(theta)
+    {
+        double zeta2 = 1.0 + std::pow(0.5, theta);
+        zetan = 0;
+        for (size_t i = 1; i <= n; i++)
+        {
+            zetan += 1.0 / std::pow((double)i, theta);
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    size_t next(double uniform) const
+    {
+        double scaled = uniform * zetan;
+        if (scaled < 1.0) {
+            return 0;
+        }
+        if (scaled < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        size_t rank = (size_t)(n * std::pow(eta * uniform - eta + 1.0, alpha));
+        return (rank < n) ? rank : n - 1;
+    }
+
+private:
+    size_t n;
+    double theta;
+    double zetan;
+    double alpha;
+    double eta;
+};
+
+enum SuitePattern { SEQUENTIAL_PATTERN, RANDOM_PATTERN, ZIPFIAN_PATTERN, SLIDING_PATTERN };
+
+const char* suite_pattern_name(SuitePattern pattern)
+{
+    static const char* const names[] = { "sequential", "random", "zipfian", "sliding" };
+    return names[pattern];
+}
+
+uint64_t suite_scramble(uint64_t id)
+{
+    // A bijection of [0, 2^31), so random keys are distinct but in no particular order
+    return (id * 2654435761u) & 0x7fffffff;
+}
+
+template <typename Key>
+Key suite_key(uint64_t id)
+{
+    return (Key)id;
+}
+
+template <>
+std::string suite_key<std::string>(uint64_t id)
+{
+    // 24 characters, longer than the small string buffer, so every key has its own allocation like real string keys
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "key:%020llu", (unsigned long long)id);
+    return buffer;
+}
+
+struct SuiteWorkload {
+    // ids of the values in insertion order and of the keys looked up
+    std::vector<uint64_t> inserted;
+    std::vector<uint64_t> lookups;
+};
+
+SuiteWorkload suite_workload(SuitePattern pattern, size_t element_count, size_t lookup_count, const ZipfGenerator* zipf)
+{
+    SuiteWorkload workload;
+    std::mt19937_64 generator(42);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    workload.inserted.resize(element_count);
+    workload.lookups.resize(lookup_count);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        switch (pattern) {
+        case RANDOM_PATTERN: workload.inserted[i] = suite_scramble(i); break;
+        case ZIPFIAN_PATTERN: workload.inserted[i] = suite_scramble(zipf->next(uniform(generator))); break;
+        default: workload.inserted[i] = i; break;
+        }
+    }
+    for (size_t i = 0; i < lookup_count; i++)
+    {
+        switch (pattern) {
+        case RANDOM_PATTERN: workload.lookups[i] = suite_scramble(generator() % element_count); break;
+        case ZIPFIAN_PATTERN: workload.lookups[i] = suite_scramble(zipf->next(uniform(generator))); break;
+        default: workload.lookups[i] = i % element_count; break;
+        }
+    }
+    return workload;
+}
+
+// The same calls for both containers, both keep equal values (std::multiset::erase(key) would delete all of them)
+template <typename Key>
+bool suite_contains(RedBlackTree<Key>& tree, const Key& key)
+{
+    return tree.find(key) != NULL;
+}
+
+template <typename Key>
+bool suite_contains(std::multiset<Key>& set, const Key& key)
+{
+    return set.find(key) != set.end();
+}
+
+template <typename Key>
+void suite_erase(RedBlackTree<Key>& tree, const Key& key)
+{
+    tree.erase(key);
+}
+
+template <typename Key>
+void suite_erase(std::multiset<Key>& set, const Key& key)
+{
+    typename std::multiset<Key>::iterator found = set.find(key);
+    if (found != set.end()) {
+        set.erase(found);
+    }
+}
+
+template <typename Key>
+void suite_merge(RedBlackTree<Key>& tree, RedBlackTree<Key>& tree2)
+{
+    // sequential like std::multiset::merge
+    tree.set_union(std::move(tree2), (size_t)-1);
+}
+
+template <typename Key>
+void suite_merge(std::multiset<Key>& set, std::multiset<Key>& set2)
+{
+    set.merge(set2);
+}
+
+enum SuiteOperation { INSERT_SUITE, FIND_SUITE, ITERATE_SUITE, ERASE_SUITE, MERGE_SUITE, SLIDE_SUITE, SUITE_OPERATIONS };
+
+const char* suite_operation_name(SuiteOperation operation)
+{
+    static const char* const names[] = { "insert", "find", "iterate", "erase", "merge", "insert+erase" };
+    return names[operation];
+}
+
+struct SuiteMeasurement {
+    // totals over all rounds, operations == 0 if the operation was not measured
+    size_t operations = 0;
+    double ns = 0;
+    double cache_misses = 0;
+    double branch_misses = 0;
+};
+
+struct SuiteResult {
+    SuiteMeasurement measurements[SUITE_OPERATIONS];
+    double bytes_per_element = 0;
+};
+
+template <typename Function>
+void suite_measure(PerfCounters& counters, SuiteMeasurement& measurement, size_t operations, Function function)
+{
+    counters.start();
+    benchClock::time_point start = benchClock::now();
+    function();
+    measurement.ns += std::chrono::duration<double, std::nano>(benchClock::now() - start).count();
+    counters.stop(measurement.cache_misses, measurement.branch_misses);
+    measurement.operations += operations;
+}
+
+template <typename Container, typename Key>
+SuiteResult suite_run(SuitePattern pattern, const SuiteWorkload& workload, size_t min_operations, PerfCounters& counters)
+{
+    // Small sizes are repeated in rounds until every operation ran at least min_operations times
+    SuiteResult result;
+    size_t element_count = workload.inserted.size();
+    std::vector<Key> inserted(element_count);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        inserted[i] = suite_key<Key>(workload.inserted[i]);
+    }
+    std::vector<Key> lookups(workload.lookups.size());
+    for (size_t i = 0; i < lookups.size(); i++)
+    {
+        lookups[i] = suite_key<Key>(workload.lookups[i]);
+    }
+    size_t rounds = std::max<size_t>(1, min_operations / element_count);
+    size_t checksum = 0;
+
+    for (size_t round = 0; round < rounds; round++)
+    {
+        Container container;
+        size_t before = heap_bytes();
+        suite_measure(counters, result.measurements[INSERT_SUITE], element_count, [&]() {
+            for (size_t i = 0; i < element_count; i++)
+            {
+                container.insert(inserted[i]);
+            }
+        });
+        result.bytes_per_element = (double)(heap_bytes() - before) / element_count;
+
+        if (pattern == SLIDING_PATTERN) {
+            // The oldest value leaves the window whenever a new one comes in
+            std::vector<Key> incoming(element_count);
+            for (size_t i = 0; i < element_count; i++)
+            {
+                incoming[i] = suite_key<Key>(element_count + i);
+            }
+            suite_measure(counters, result.measurements[SLIDE_SUITE], element_count, [&]() {
+                for (size_t i = 0; i < element_count; i++)
+                {
+                    container.insert(incoming[i]);
+                    suite_erase(container, inserted[i]);
+                }
+            });
+            continue;
+        }
+
+        if (round == 0) {
+            suite_measure(counters, result.measurements[FIND_SUITE], lookups.size(), [&]() {
+                for (size_t i = 0; i < lookups.size(); i++)
+                {
+                    checksum += suite_contains(container, lookups[i]);
+                }
+            });
+        }
+        suite_measure(counters, result.measurements[ITERATE_SUITE], element_count, [&]() {
+            for (typename Container::iterator it = container.begin(); it != container.end(); ++it)
+            {
+                checksum += (size_t)&*it & 1;
+            }
+        });
+        suite_measure(counters, result.measurements[ERASE_SUITE], element_count, [&]() {
+            for (size_t i = 0; i < element_count; i++)
+            {
+                suite_erase(container, inserted[i]);
+            }
+        });
+
+        // Values of the even and the odd positions in two containers, Zipfian values repeat, so there is no merge for them
+        if (pattern != ZIPFIAN_PATTERN) {
+            Container other;
+            for (size_t i = 0; i < element_count; i++)
+            {
+                if (i % 2 == 0) {
+                    container.insert(inserted[i]);
+                }
+                else {
+                    other.insert(inserted[i]);
+                }
+            }
+            suite_measure(counters, result.measurements[MERGE_SUITE], element_count, [&]() {
+                suite_merge(container, other);
+            });
+            checksum += std::distance(container.begin(), container.end()) != (std::ptrdiff_t)element_count;
+        }
+    }
+    if (checksum == 42) {
+        std::cout << "";
+    }
+    return result;
+}
+
+void suite_print(const SuiteMeasurement& tree, const SuiteMeasurement& set, bool perf)
+{
+    std::cout << "\t" << tree.ns / tree.operations << "\t" << set.ns / set.operations;
+    if (perf) {
+        std::cout << "\t" << tree.cache_misses / tree.operations << "\t" << set.cache_misses / set.operations;
+        std::cout << "\t" << tree.branch_misses / tree.operations << "\t" << set.branch_misses / set.operations;
+    }
+}
+
+template <typename Key>
+void bench_suite_key(const char* key_name, size_t max_elements, PerfCounters& counters)
+{
+    const size_t min_operations = 1000000;
+    for (size_t element_count = 1000; element_count <= max_elements; element_count *= 10)
+    {
+        ZipfGenerator zipf(element_count, 0.99);
+        for (SuitePattern pattern : { SEQUENTIAL_PATTERN, RANDOM_PATTERN, ZIPFIAN_PATTERN, SLIDING_PATTERN })
+        {
+            SuiteWorkload workload = suite_workload(pattern, element_count, std::min<size_t>(element_count * 10, min_operations), &zipf);
+            SuiteResult tree = suite_run<RedBlackTree<Key>, Key>(pattern, workload, min_operations, counters);
+            SuiteResult set = suite_run<std::multiset<Key>, Key>(pattern, workload, min_operations, counters);
+            for (int operation = 0; operation < SUITE_OPERATIONS; operation++)
+            {
+                if (tree.measurements[operation].operations == 0) {
+                    continue;
+                }
+                std::cout << key_name << "\t" << element_count << "\t" << suite_pattern_name(pattern) << "\t" << suite_operation_name((SuiteOperation)operation);
+                suite_print(tree.measurements[operation], set.measurements[operation], counters.available());
+                if (operation == INSERT_SUITE) {
+                    std::cout << "\t" << tree.bytes_per_element << "\t" << set.bytes_per_element;
+                }
+                std::cout << std::endl;
+            }
+        }
+    }
+}
+
+void bench_suite(size_t max_elements)
+{
+    // Tab-separated, tree columns first: ns/op, [cache misses/op, branch misses/op,] and bytes/element for inserts
+    PerfCounters counters;
+    std::cout << "Workload suite, 10^3 to " << max_elements << " elements, RedBlackTree against std::multiset" << std::endl;
+    if (!counters.available()) {
+        std::cout << "No hardware counters: perf events are not available, the miss columns are left out" << std::endl;
+    }
+    std::cout << "key\tsize\tpattern\toperation\ttree ns/op\tset ns/op";
+    if (counters.available()) {
+        std::cout << "\ttree cache misses/op\tset cache misses/op\ttree branch misses/op\tset branch misses/op";
+    }
+    std::cout << "\ttree B/element\tset B/element" << std::endl;
+    bench_suite_key<int>("int", max_elements, counters);
+    bench_suite_key<long long>("int64", max_elements, counters);
+    bench_suite_key<std::string>("string", max_elements, counters);
+}
+
+int main(int argc, char** argv) {
+    // bench suite [max elements] runs only the workload suite (up to 10^6 elements by default)
+    if (argc > 1 && std::string(argv[1]) == "suite") {
+        bench_suite((argc > 2) ? (size_t)std::strtoull(argv[2], NULL, 10) : 1000000);
+        return 0;
+    }
+
+    bench_allocators(100000);
+    bench_allocators(1000000);
+    bench_set_operations(1000000);
+    bench_set_operations(10000000);
+    bench_sorted_streams(1000000);
+    bench_priority_queues(400000);
+    bench_priority_queues(4000000);
+    bench_scans(1000000);
+    bench_scans(10000000);
+    bench_memory(1000000);
+    bench_frozen(100000);
+    bench_frozen(10000000);
+    bench_find_batches(10000000);
+    bench_persistent_writer(1000000);
+    bench_snapshots(1000000, 2);
+    bench_sharded(2000000);
+    bench_batches(1000000);
+    bench_build_parallel(10000000);
+    bench_expire(1000000);
+    bench_stats(1000000);
+    bench_mapped(10000000);
+
+    return 0;
+}
@@ -1,16 +1,68 @@
-// Check for memory leaks
-#define _CRTDBG_MAP_ALLOC
-#include <stdlib.h>
-#include <crtdbg.h>
-
+#include <cstdlib>
+#include <new>
+#include <atomic>
 #include <memory>
+#include <vector>
 #include <set>
+#include <map>
 #include <algorithm>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <functional>
 #include <iostream>
 #include "RedBlackTree.h"
+#include "IntervalTree.h"
+#include "RedBlackMap.h"
+#include "FrozenRedBlackTree.h"
+#include "PersistentRedBlackTree.h"
+#include "ShardedRedBlackTree.h"
+#include "MappedRedBlackTree.h"
+#include <cstdio>
 
-template <typename T>
-bool red_black_properties(RedBlackNode<T>* node, size_t blackheight, size_t blackheight_prev) {
+// Count heap allocations of the whole program to find leaks and to measure allocations per operation
+std::atomic<size_t> allocation_count(0);
+std::atomic<size_t> live_allocations(0);
+
+void* counted_allocate(size_t size, size_t alignment)
+{
+    void* pointer = (alignment <= alignof(std::max_align_t)) ? std::malloc(size ? size : 1) : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (pointer == NULL) {
+        throw std::bad_alloc();
+    }
+    allocation_count++;
+    live_allocations++;
+    return pointer;
+}
+
+void counted_free(void* pointer)
+{
+    if (pointer != NULL) {
+        live_allocations--;
+        std::free(pointer);
+    }
+}
+
+void* operator new(size_t size) { return counted_allocate(size, 0); }
+void* operator new[](size_t size) { return counted_allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return counted_allocate(size, (size_t)alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return counted_allocate(size, (size_t)alignment); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { try { return counted_allocate(size, 0); } catch (...) { return NULL; } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { try { return counted_allocate(size, 0); } catch (...) { return NULL; } }
+void operator delete(void* pointer) noexcept { counted_free(pointer); }
+void operator delete[](void* pointer) noexcept { counted_free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { counted_free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { counted_free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { counted_free(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { counted_free(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { counted_free(pointer); }
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept { counted_free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { counted_free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { counted_free(pointer); }
+
+template <typename T, typename Augment>
+bool red_black_properties(RedBlackNode<T, Augment>* node, size_t blackheight, size_t blackheight_prev) {
     bool test = true;
     if (node != NULL) {
 
@@ -25,15 +77,15 @@ bool red_black_properties(RedBlackNode<T>* node, size_t blackheight, size_t blac
         }
 
         //check the properties of red-black tree
-        else if (node->color == RED) { //If a node is red, then both its children are black
-            if (((node->left != NULL) && (node->left->color == RED))
-                || ((node->right != NULL) && (node->right->color == RED))) {
+        else if (node->getColor() == RED) { //If a node is red, then both its children are black
+            if (((node->left != NULL) && (node->left->getColor() == RED))
+                || ((node->right != NULL) && (node->right->getColor() == RED))) {
                 std::cout << "If a node is red, then both its children must be black!" << std::endl;
                 test = false;
             }
         }
         //every path from a node to a leaf contains the same number of black nodes
-        else if (node->color == BLACK) {
+        else if (node->getColor() == BLACK) {
             blackheight++;
             if (node->left == NULL && node->right == NULL) {
                 if (blackheight_prev == 0) {
@@ -50,14 +102,34 @@ bool red_black_properties(RedBlackNode<T>* node, size_t blackheight, size_t blac
             return false;
         }
         else {
-            test = (red_black_properties(node->left, blackheight, blackheight_prev) && red_black_properties(node->right, blackheight, blackheight_prev));
+            test = (red_black_properties<T, Augment>(node->left, blackheight, blackheight_prev) && red_black_properties<T, Augment>(node->right, blackheight, blackheight_prev));
         }
     }
     return test;
 }
 
-template <typename T>
-void check_properties(RedBlackTree<T> tree) {
+template <typename T, typename Augment>
+int black_height(RedBlackNode<T, Augment>* node)
+{
+    // Black height of the subtree, -1 if a red node has a red child or two paths have different black heights
+    if (node == NULL) {
+        return 0;
+    }
+    RedBlackNode<T, Augment>* left = node->left;
+    RedBlackNode<T, Augment>* right = node->right;
+    if (node->getColor() == RED && ((left != NULL && left->getColor() == RED) || (right != NULL && right->getColor() == RED))) {
+        return -1;
+    }
+    int left_height = black_height(left);
+    int right_height = black_height(right);
+    if (left_height < 0 || left_height != right_height) {
+        return -1;
+    }
+    return left_height + (node->getColor() == BLACK);
+}
+
+template <typename T, typename Allocator, typename Augment, typename Compare>
+void check_properties(RedBlackTree<T, Allocator, Augment, Compare> tree) {
     if (red_black_properties(tree.root, 0, 0)) {
         std::cout << "TREE PASSED ALL TESTS OF RED-BLACK TREE PROPERTIES" << std::endl;
     }
@@ -147,165 +219,1982 @@ bool test_multi_merge(size_t element_count1, size_t element_count2)
     return std::equal(reference_multiset.begin(), reference_multiset.end(), tree1.begin());
 }
 
-bool test_multi_find(size_t element_count)
+bool test_join(size_t element_count1, size_t element_count2)
+{
+    std::vector<int> values;
+    RedBlackTree<int> tree1;
+    RedBlackTree<int> tree2;
+    RedBlackTree<int> tree3;
+
+    srand(7);
+    for (size_t i = 0; i < element_count1 + element_count2 + 50; i++)
+    {
+        values.push_back(rand() % 10000);
+    }
+    std::sort(values.begin(), values.end());
+
+    // Different black heights: tree1 is built by inserts, tree2 and tree3 from sorted ranges
+    for (size_t i = 0; i < element_count1; i++)
+    {
+        tree1.insert(values[i]);
+    }
+    tree2.assign(values.begin() + element_count1, values.begin() + element_count1 + element_count2);
+    tree3.assign(values.begin() + element_count1 + element_count2 + 1, values.end());
+
+    tree1.join(std::move(tree2));
+    tree1.join(values[element_count1 + element_count2], std::move(tree3));
+
+    if (!tree2.empty() || !tree3.empty() || !red_black_properties(tree1.root, 0, 0) || black_height(tree1.root) < 0) {
+        return false;
+    }
+
+    // Joining a tree with itself is refused and leaves it unchanged
+    tree1.join(std::move(tree1));
+    tree1.join(values[0], std::move(tree1));
+    return red_black_properties(tree1.root, 0, 0) && black_height(tree1.root) >= 0 && std::equal(values.begin(), values.end(), tree1.begin(), tree1.end());
+}
+
+bool test_split(size_t element_count)
 {
     std::multiset<int> reference_multiset;
-    RedBlackTree<int> tree;
 
-    srand(42);
+    srand(11);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        reference_multiset.insert(rand() % 1000);
+    }
+
+    // Keys inside the range and at both ends, both halves have to be valid trees
+    int keys[] = { 500, -1, 0, 999, 1000 };
+    for (int key : keys)
+    {
+        RedBlackTree<int> tree;
+        for (std::multiset<int>::iterator it = reference_multiset.begin(); it != reference_multiset.end(); ++it)
+        {
+            tree.insert(*it);
+        }
+
+        std::pair<RedBlackTree<int>, RedBlackTree<int> > trees = tree.split(key);
+        if (!tree.empty() || !red_black_properties(trees.first.root, 0, 0) || !red_black_properties(trees.second.root, 0, 0)) {
+            return false;
+        }
+        if (black_height(trees.first.root) < 0 || black_height(trees.second.root) < 0) {
+            return false;
+        }
+        if (!std::equal(reference_multiset.begin(), reference_multiset.lower_bound(key), trees.first.begin(), trees.first.end())) {
+            return false;
+        }
+        if (trees.first.max() != trees.first.end() && *trees.first.max() >= key) {
+            return false;
+        }
+        if (!std::equal(reference_multiset.lower_bound(key), reference_multiset.end(), trees.second.begin(), trees.second.end())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_set_operations(size_t element_count, size_t grain)
+{
+    // Unique values first, then values repeated in both trees (the nodes of trees1 decide the multiplicity)
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int range = (pass == 0) ? (int)(2 * element_count) : (int)(element_count / 4) + 1;
+        std::multiset<int> reference1;
+        std::multiset<int> reference2;
+        RedBlackTree<int> trees1[3];
+        RedBlackTree<int> trees2[3];
+
+        srand(5);
+        for (size_t i = 0; i < element_count; i++)
+        {
+            int value1 = rand() % range;
+            int value2 = rand() % range;
+
+            if (pass == 1 || reference1.count(value1) == 0) {
+                reference1.insert(value1);
+                for (size_t j = 0; j < 3; j++) {
+                    trees1[j].insert(value1);
+                }
+            }
+            if (pass == 1 || reference2.count(value2) == 0) {
+                reference2.insert(value2);
+                for (size_t j = 0; j < 3; j++) {
+                    trees2[j].insert(value2);
+                }
+            }
+        }
+
+        // Union keeps all of trees1 and the values of trees2 missing in it, the others keep nodes of trees1
+        std::vector<int> reference_union(reference1.begin(), reference1.end());
+        std::vector<int> reference_intersection;
+        std::vector<int> reference_difference;
+        for (std::multiset<int>::iterator it = reference2.begin(); it != reference2.end(); ++it)
+        {
+            if (reference1.count(*it) == 0) {
+                reference_union.push_back(*it);
+            }
+        }
+        std::sort(reference_union.begin(), reference_union.end());
+        for (std::multiset<int>::iterator it = reference1.begin(); it != reference1.end(); ++it)
+        {
+            (reference2.count(*it) != 0 ? reference_intersection : reference_difference).push_back(*it);
+        }
+
+        trees1[0].set_union(std::move(trees2[0]), grain);
+        trees1[1].set_intersection(std::move(trees2[1]), grain);
+        trees1[2].set_difference(std::move(trees2[2]), grain);
+
+        for (size_t j = 0; j < 3; j++) {
+            if (!trees2[j].empty() || !red_black_properties(trees1[j].root, 0, 0) || black_height(trees1[j].root) < 0) {
+                return false;
+            }
+        }
+
+        if (!std::equal(reference_union.begin(), reference_union.end(), trees1[0].begin(), trees1[0].end())
+            || !std::equal(reference_intersection.begin(), reference_intersection.end(), trees1[1].begin(), trees1[1].end())
+            || !std::equal(reference_difference.begin(), reference_difference.end(), trees1[2].begin(), trees1[2].end())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_order_statistics(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int, std::allocator<int>, OrderStatistics> tree;
 
+    srand(9);
     for (size_t i = 0; i < element_count; i++)
     {
-        int value = rand();
+        int value = rand() % 500;
 
         reference_multiset.insert(value);
         tree.insert(value);
     }
 
-    for (size_t i = 0; i < 100; i++)
+    for (size_t i = 0; i < element_count / 2; i++)
     {
-        int value = rand();
-        bool found_tree = true;
-        bool found_set = true;
-        if (tree.find(value) == NULL) {
-            found_tree = false;
+        int value = rand() % 500;
+
+        if (reference_multiset.find(value) != reference_multiset.end()) {
+            reference_multiset.erase(reference_multiset.find(value));
+        }
+        tree.erase(value);
+    }
+
+    // Split and join back, sizes must survive relinking
+    std::pair<RedBlackTree<int, std::allocator<int>, OrderStatistics>, RedBlackTree<int, std::allocator<int>, OrderStatistics> > trees = tree.split(250);
+    trees.first.join(std::move(trees.second));
+    tree = trees.first;
+
+    if (!red_black_properties(tree.root, 0, 0) || black_height(tree.root) < 0 || tree.size() != reference_multiset.size()) {
+        return false;
+    }
+
+    size_t k = 0;
+    for (auto it = reference_multiset.begin(); it != reference_multiset.end(); ++it, ++k) {
+        if (*tree.select(k) != *it) {
+            return false;
         }
-        if ((reference_multiset.find(value) != reference_multiset.end()) && !found_tree) {
+    }
+    if (tree.select(k) != tree.end()) {
+        return false;
+    }
+
+    for (int value = -1; value <= 501; value++) {
+        if (tree.rank(value) != (size_t)std::distance(reference_multiset.begin(), reference_multiset.lower_bound(value))) {
             return false;
         }
-        else if (found_tree && (tree.find(value)->value != value)) {
+        if (tree.count_range(value, value + 50) != (size_t)std::distance(reference_multiset.lower_bound(value), reference_multiset.lower_bound(value + 50))) {
             return false;
         }
     }
     return true;
 }
 
-bool test_min_max(size_t element_count)
+bool test_aggregate(size_t element_count)
 {
+    typedef Augments<Aggregate<SumMonoid<long long> >, Aggregate<MaxMonoid<int> > > SumMax;
     std::multiset<int> reference_multiset;
-    RedBlackTree<int> tree;
-
-    srand(42);
+    RedBlackTree<int, std::allocator<int>, SumMax> tree;
 
+    srand(13);
     for (size_t i = 0; i < element_count; i++)
     {
-        int value = rand();
+        int value = rand() % 1000;
 
         reference_multiset.insert(value);
         tree.insert(value);
     }
 
-    if (*tree.min() != *std::min_element(reference_multiset.begin(), reference_multiset.end())) {
+    for (size_t i = 0; i < element_count / 2; i++)
+    {
+        int value = rand() % 1000;
+
+        if (reference_multiset.find(value) != reference_multiset.end()) {
+            reference_multiset.erase(reference_multiset.find(value));
+        }
+        tree.erase(value);
+    }
+    if (!red_black_properties(tree.root, 0, 0) || black_height(tree.root) < 0) {
         return false;
     }
 
-    if (*tree.max() != *std::max_element(reference_multiset.begin(), reference_multiset.end())) {
+    for (int low = -10; low < 1010; low += 17) {
+        for (int high = low; high < 1020; high += 53) {
+            long long sum = 0;
+            int max = std::numeric_limits<int>::lowest();
+            for (auto it = reference_multiset.lower_bound(low); it != reference_multiset.lower_bound(high); ++it) {
+                sum += *it;
+                max = std::max(max, *it);
+            }
+            if (tree.aggregate<Aggregate<SumMonoid<long long> > >(low, high) != sum) {
+                return false;
+            }
+            if (tree.aggregate<Aggregate<MaxMonoid<int> > >(low, high) != max) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool test_interval_tree(size_t element_count)
+{
+    std::vector<Interval<int> > reference_intervals;
+    IntervalTree<int> intervals;
+
+    srand(17);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int low = rand() % 10000;
+        Interval<int> interval(low, low + rand() % 300);
+
+        reference_intervals.push_back(interval);
+        intervals.insert(interval);
+    }
+
+    for (size_t i = 0; i < element_count / 4; i++)
+    {
+        intervals.erase(reference_intervals.back());
+        reference_intervals.pop_back();
+    }
+    if (!red_black_properties(intervals.tree.root, 0, 0) || black_height(intervals.tree.root) < 0) {
         return false;
     }
+
+    std::sort(reference_intervals.begin(), reference_intervals.end());
+    for (int low = -100; low < 10500; low += 131) {
+        int high = low + (low % 7) * 20;
+        std::vector<Interval<int> > expected;
+        for (size_t i = 0; i < reference_intervals.size(); i++) {
+            if (reference_intervals[i].low <= high && reference_intervals[i].high >= low) {
+                expected.push_back(reference_intervals[i]);
+            }
+        }
+        if (intervals.overlaps(low, high) != expected) {
+            return false;
+        }
+
+        size_t stabbed = 0;
+        intervals.visit_stab(low, [&stabbed, low](const Interval<int>& interval) {
+            if (interval.low <= low && low <= interval.high) {
+                stabbed++;
+            }
+        });
+        if (stabbed != intervals.stab(low).size()) {
+            return false;
+        }
+    }
     return true;
 }
 
-bool test_iterators(size_t element_count)
+bool test_bounds(size_t element_count)
 {
     std::multiset<int> reference_multiset;
     RedBlackTree<int> tree;
 
-    srand(42);
-
+    srand(19);
     for (size_t i = 0; i < element_count; i++)
     {
-        int value = rand();
+        int value = rand() % 300;
 
         reference_multiset.insert(value);
         tree.insert(value);
     }
 
-    auto it_set = reference_multiset.begin();
-    for (auto it = tree.begin(); it != tree.end(); it++) {
-        if (*it != *it_set) {
+    for (int value = -1; value <= 301; value++) {
+        RedBlackTree<int>::iterator lower = tree.lower_bound(value);
+        RedBlackTree<int>::iterator upper = tree.upper_bound(value);
+        std::multiset<int>::iterator reference_lower = reference_multiset.lower_bound(value);
+        std::multiset<int>::iterator reference_upper = reference_multiset.upper_bound(value);
+
+        if ((lower == tree.end()) != (reference_lower == reference_multiset.end()) || (lower != tree.end() && *lower != *reference_lower)) {
             return false;
         }
-        it_set++;
-    }
-
-    it_set = reference_multiset.begin();
-    for (auto it = tree.begin(); it != tree.end(); ++it) {
-        if (*it != *it_set) {
+        if ((upper == tree.end()) != (reference_upper == reference_multiset.end()) || (upper != tree.end() && *upper != *reference_upper)) {
             return false;
         }
-        ++it_set;
-    }
-
-    it_set = std::max_element(reference_multiset.begin(), reference_multiset.end());
-    for (auto it = tree.max(); it != tree.end(); it--) {
-        if (*it != *it_set) {
+        if (std::distance(tree.equal_range(value).first, tree.equal_range(value).second) != (std::ptrdiff_t)reference_multiset.count(value)) {
             return false;
         }
-        it_set--;
     }
+    return true;
+}
 
-    it_set = std::max_element(reference_multiset.begin(), reference_multiset.end());
-    for (auto it = tree.max(); it != tree.end(); --it) {
-        if (*it != *it_set) {
+bool test_comparators()
+{
+    // Reverse order
+    std::multiset<int, std::greater<int> > reference_multiset;
+    RedBlackTree<int, std::allocator<int>, NoAugment, std::greater<int> > reversed;
+
+    srand(23);
+    for (size_t i = 0; i < 500; i++)
+    {
+        int value = rand() % 100;
+
+        reference_multiset.insert(value);
+        reversed.insert(value);
+    }
+    if (!std::equal(reference_multiset.begin(), reference_multiset.end(), reversed.begin())) {
+        return false;
+    }
+    if (*reversed.lower_bound(50) != *reference_multiset.lower_bound(50)) {
+        return false;
+    }
+
+    // Heterogeneous lookup by std::string_view and a three-way comparator
+    RedBlackTree<std::string, std::allocator<std::string>, NoAugment, std::less<> > strings;
+    RedBlackTree<std::string, std::allocator<std::string>, NoAugment, ThreeWayCompare> strings3;
+    for (size_t i = 0; i < 500; i++)
+    {
+        std::string value = "key" + std::to_string(rand() % 1000);
+
+        strings.insert(value);
+        strings3.insert(value);
+    }
+    if (!red_black_properties(strings.root, 0, 0) || black_height(strings.root) < 0 ||
+        !red_black_properties(strings3.root, 0, 0) || black_height(strings3.root) < 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < 1000; i++)
+    {
+        std::string value = "key" + std::to_string(i);
+        std::string_view key(value);
+
+        if ((strings.find(key) == NULL) != (strings3.find(key) == NULL)) {
+            return false;
+        }
+        if (strings.find(key) != NULL && strings.find(key)->value != value) {
+            return false;
+        }
+        if (strings3.find(key) != NULL && strings3.find(key)->value != value) {
+            return false;
+        }
+        if (strings.lower_bound(key) != strings.lower_bound(value) || strings3.upper_bound(key) != strings3.upper_bound(value)) {
             return false;
         }
-        --it_set;
     }
-
     return true;
 }
 
-bool run_tests()
-{
+struct CountedPayload {
+    //counts copies, the map must only ever move or construct payloads in place
+    static size_t copies;
+    static size_t constructions;
+    int value;
 
-    bool currentTestOk;
-    bool allTestsOk = true;
+    explicit CountedPayload(int v = 0) : value(v) { constructions++; }
+    CountedPayload(const CountedPayload& that) : value(that.value) { copies++; }
+    CountedPayload(CountedPayload&& that) noexcept : value(that.value) {}
 
-    std::cout << "Small multiple insert test:\t";
-    currentTestOk = test_multi_insert(100);
-    allTestsOk = allTestsOk || !currentTestOk;
-    std::cout << (currentTestOk ? "OK" : "ERROR");
-    std::cout << std::endl;
+    bool operator<(const CountedPayload& that) const { return value < that.value; }
+    bool operator>(const CountedPayload& that) const { return that.value < value; }
+};
 
-    std::cout << "Large multiple insert test:\t";
-    currentTestOk = test_multi_insert(10000);
-    allTestsOk = allTestsOk || !currentTestOk;
-    std::cout << (currentTestOk ? "OK" : "ERROR");
-    std::cout << std::endl;
+size_t CountedPayload::copies = 0;
+size_t CountedPayload::constructions = 0;
 
-    std::cout << "Erase test:\t";
-    currentTestOk = test_multi_erase(100, 30);
-    allTestsOk = allTestsOk || !currentTestOk;
-    std::cout << (currentTestOk ? "OK" : "ERROR");
-    std::cout << std::endl;
+bool test_map(size_t element_count)
+{
+    std::map<int, int> reference_map;
+    RedBlackMap<int, std::unique_ptr<int> > owners;
+    RedBlackMap<int, CountedPayload> payloads;
 
-    std::cout << "Small merge test:\t";
-    currentTestOk = test_multi_merge(50, 100);
-    allTestsOk = allTestsOk || !currentTestOk;
-    std::cout << (currentTestOk ? "OK" : "ERROR");
-    std::cout << std::endl;
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int key = rand() % (int)element_count;
 
-    std::cout << "Large merge test:\t";
-    currentTestOk = test_multi_merge(400, 500);
-    allTestsOk = allTestsOk || !currentTestOk;
-    std::cout << (currentTestOk ? "OK" : "ERROR");
-    std::cout << std::endl;
+        bool inserted = reference_map.emplace(key, (int)i).second;
+        if (owners.try_emplace(key, std::unique_ptr<int>(new int((int)i))).second != inserted) {
+            return false;
+        }
+        if (!inserted) {
+            continue;
+        }
+        if (!owners.emplace(key, std::unique_ptr<int>(new int(-1))).first->second || *owners[key] != (int)i) {
+            return false;
+        }
 
-    std::cout << "Find test:\t";
-    currentTestOk = test_multi_find(300);
-    allTestsOk = allTestsOk || !currentTestOk;
-    std::cout << (currentTestOk ? "OK" : "ERROR");
-    std::cout << std::endl;
+        //try_emplace on an existing key must not construct the payload
+        size_t constructions = CountedPayload::constructions;
+        payloads.try_emplace(key, (int)i);
+        payloads.try_emplace(key, -1);
+        if (CountedPayload::constructions != constructions + 1) {
+            return false;
+        }
+    }
+    if (!red_black_properties(owners.tree.root, 0, 0) || !red_black_properties(payloads.tree.root, 0, 0)) {
+        return false;
+    }
 
-    std::cout << "Min/max test:\t";
-    currentTestOk = test_multi_find(300);
-    allTestsOk = allTestsOk || !currentTestOk;
-    std::cout << (currentTestOk ? "OK" : "ERROR");
-    std::cout << std::endl;
+    for (size_t i = 0; i < element_count; i += 3)
+    {
+        int key = (int)i;
+        size_t erased = reference_map.erase(key);
+        if (owners.erase(key) != erased || payloads.erase(key) != erased) {
+            return false;
+        }
+    }
+    if (!red_black_properties(owners.tree.root, 0, 0) || !red_black_properties(payloads.tree.root, 0, 0)) {
+        return false;
+    }
 
-    std::cout << "Iterators test:\t";
-    currentTestOk = test_iterators(300);
-    allTestsOk = allTestsOk || !currentTestOk;
+    if (owners.size() != reference_map.size() || payloads.size() != reference_map.size()) {
+        return false;
+    }
+    std::map<int, int>::iterator reference = reference_map.begin();
+    for (RedBlackMap<int, std::unique_ptr<int> >::iterator it = owners.begin(); it != owners.end(); ++it, ++reference)
+    {
+        if (it->first != reference->first || *it->second != reference->second || payloads.at(it->first).value != reference->second) {
+            return false;
+        }
+    }
+
+    payloads[-5].value = 7;
+    if (payloads.at(-5).value != 7 || payloads.size() != reference_map.size() + 1) {
+        return false;
+    }
+
+    owners.clear();
+    payloads.clear();
+    return CountedPayload::copies == 0;
+}
+
+bool test_erase_iterators(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<CountedPayload> tree;
+
+    srand(17);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % 1000;
+
+        reference_multiset.insert(value);
+        tree.emplace(value);
+    }
+    size_t copies = CountedPayload::copies;
+
+    // Erasing relinks nodes, so the remaining values stay at their addresses
+    std::vector<const CountedPayload*> kept;
+    for (RedBlackTree<CountedPayload>::iterator it = tree.begin(); it != tree.end();)
+    {
+        if (it->value % 2 == 0) {
+            it = tree.erase(it);
+        }
+        else {
+            kept.push_back(&*it);
+            ++it;
+        }
+    }
+    for (std::multiset<int>::iterator it = reference_multiset.begin(); it != reference_multiset.end();)
+    {
+        it = (*it % 2 == 0) ? reference_multiset.erase(it) : std::next(it);
+    }
+    if (!red_black_properties(tree.root, 0, 0) || kept.size() != reference_multiset.size()) {
+        return false;
+    }
+    std::vector<const CountedPayload*>::iterator address = kept.begin();
+    std::multiset<int>::iterator reference = reference_multiset.begin();
+    for (RedBlackTree<CountedPayload>::const_iterator it = tree.cbegin(); it != tree.cend(); ++it, ++address, ++reference)
+    {
+        if (&*it != *address || it->value != *reference) {
+            return false;
+        }
+    }
+
+    // Range erase returns last, the max and min are kept up to date
+    RedBlackTree<CountedPayload>::iterator last = tree.lower_bound(CountedPayload(600));
+    if (tree.erase(tree.lower_bound(CountedPayload(200)), last) != last) {
+        return false;
+    }
+    reference_multiset.erase(reference_multiset.lower_bound(200), reference_multiset.lower_bound(600));
+    tree.erase(tree.lower_bound(CountedPayload(900)), tree.end());
+    reference_multiset.erase(reference_multiset.lower_bound(900), reference_multiset.end());
+    if (!red_black_properties(tree.root, 0, 0) || tree.max()->value != *reference_multiset.rbegin() || tree.min()->value != *reference_multiset.begin()) {
+        return false;
+    }
+    reference = reference_multiset.begin();
+    for (RedBlackTree<CountedPayload>::iterator it = tree.begin(); it != tree.end(); ++it, ++reference)
+    {
+        if (reference == reference_multiset.end() || it->value != *reference) {
+            return false;
+        }
+    }
+    if (reference != reference_multiset.end()) {
+        return false;
+    }
+
+    tree.erase(tree.begin(), tree.end());
+    if (!tree.empty() || tree.begin() != tree.end()) {
+        return false;
+    }
+
+    // Expiring the oldest entries of a map
+    RedBlackMap<int, CountedPayload> expiring;
+    for (int i = 0; i < (int)element_count; i++)
+    {
+        expiring.try_emplace(i, i);
+    }
+    expiring.erase(expiring.begin(), expiring.lower_bound((int)element_count / 2));
+    if (expiring.size() != element_count - element_count / 2 || expiring.begin()->first != (int)element_count / 2 || !red_black_properties(expiring.tree.root, 0, 0)) {
+        return false;
+    }
+    return CountedPayload::copies == copies;
+}
+
+bool test_multi_find(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int> tree;
+
+    srand(42);
+
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand();
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+
+    for (size_t i = 0; i < 100; i++)
+    {
+        int value = rand();
+        bool found_tree = (tree.find(value) != NULL);
+        bool found_set = (reference_multiset.find(value) != reference_multiset.end());
+        if (found_set != found_tree) {
+            return false;
+        }
+        else if (found_tree && (tree.find(value)->value != value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_min_max(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int> tree;
+
+    srand(42);
+
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand();
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+
+    if (*tree.min() != *std::min_element(reference_multiset.begin(), reference_multiset.end())) {
+        return false;
+    }
+
+    if (*tree.max() != *std::max_element(reference_multiset.begin(), reference_multiset.end())) {
+        return false;
+    }
+    return true;
+}
+
+bool test_iterators(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int> tree;
+
+    srand(42);
+
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand();
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+
+    auto it_set = reference_multiset.begin();
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        if (*it != *it_set) {
+            return false;
+        }
+        it_set++;
+    }
+
+    it_set = reference_multiset.begin();
+    for (auto it = tree.begin(); it != tree.end(); ++it) {
+        if (*it != *it_set) {
+            return false;
+        }
+        ++it_set;
+    }
+
+    it_set = std::max_element(reference_multiset.begin(), reference_multiset.end());
+    for (auto it = tree.max(); it != tree.end(); it--) {
+        if (*it != *it_set) {
+            return false;
+        }
+        it_set--;
+    }
+
+    it_set = std::max_element(reference_multiset.begin(), reference_multiset.end());
+    for (auto it = tree.max(); it != tree.end(); --it) {
+        if (*it != *it_set) {
+            return false;
+        }
+        --it_set;
+    }
+
+    return true;
+}
+
+bool test_for_each(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int> tree;
+
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % 1000;
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+
+    // Const iteration returns references to the stored values
+    const RedBlackTree<int>& constTree = tree;
+    RedBlackTree<int>::const_iterator it = constTree.begin();
+    if (&*it != &*tree.begin() || (size_t)std::distance(constTree.begin(), constTree.end()) != element_count) {
+        return false;
+    }
+    if (!std::equal(reference_multiset.rbegin(), reference_multiset.rend(), std::reverse_iterator<RedBlackTree<int>::const_iterator>(tree.cend()))) {
+        return false;
+    }
+    RedBlackTree<int>::const_iterator converted = tree.begin();
+    if (converted != constTree.begin() || *converted++ != *reference_multiset.begin() || *converted != *std::next(reference_multiset.begin())) {
+        return false;
+    }
+
+    std::vector<int> visited;
+    tree.for_each([&visited](int value) { visited.push_back(value); });
+    if (!std::equal(reference_multiset.begin(), reference_multiset.end(), visited.begin(), visited.end())) {
+        return false;
+    }
+
+    for (int low = -10; low < 1010; low += 37)
+    {
+        for (int high = low - 20; high < 1020; high += 113)
+        {
+            visited.clear();
+            tree.for_each(low, high, [&visited](int value) { visited.push_back(value); });
+            std::multiset<int>::iterator first = reference_multiset.lower_bound(low);
+            std::multiset<int>::iterator last = (high < low) ? first : reference_multiset.lower_bound(high);
+            if (!std::equal(first, last, visited.begin(), visited.end())) {
+                return false;
+            }
+        }
+    }
+    tree.clear();
+    return true;
+}
+
+bool test_sorted_construction(size_t element_count)
+{
+    std::vector<int> values;
+
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        values.push_back(rand() % 1000);
+    }
+    std::sort(values.begin(), values.end());
+
+    for (size_t count = 0; count <= element_count; count += (count < 20 ? 1 : 97))
+    {
+        RedBlackTree<int> tree(values.begin(), values.begin() + count);
+
+        if (!red_black_properties(tree.root, 0, 0) || black_height(tree.root) < 0 || (tree.root != NULL && tree.root->color != BLACK)) {
+            return false;
+        }
+        if (!std::equal(values.begin(), values.begin() + count, tree.begin(), tree.end())) {
+            return false;
+        }
+    }
+
+    // Unsorted input is rejected and the tree stays the same
+    RedBlackTree<int> tree(values.begin(), values.end());
+    std::swap(values[0], values[values.size() - 1]);
+    tree.assign(values.begin(), values.end());
+    std::swap(values[0], values[values.size() - 1]);
+
+    return red_black_properties(tree.root, 0, 0) && black_height(tree.root) > 0 && std::equal(values.begin(), values.end(), tree.begin(), tree.end());
+}
+
+bool test_hinted_insert(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int> tree;
+
+    // Nearly sorted stream, the hint is the position after the previous value
+    srand(42);
+    RedBlackTree<int>::iterator hint = tree.end();
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = (int)i + rand() % 8;
+
+        reference_multiset.insert(value);
+        hint = tree.insert(hint, value);
+        ++hint;
+    }
+    if (!red_black_properties(tree.root, 0, 0) || !std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin())) {
+        return false;
+    }
+
+    // Good, wrong and end() hints with duplicates
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % (int)element_count;
+
+        reference_multiset.insert(value);
+        switch (i % 3) {
+        case 0:
+            tree.insert(tree.lower_bound(value), value);
+            break;
+        case 1:
+            tree.insert(tree.begin(), value);
+            break;
+        default:
+            tree.insert(tree.end(), value);
+        }
+    }
+    if (!red_black_properties(tree.root, 0, 0) || !std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin())) {
+        return false;
+    }
+
+    // Appending past the maximum
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = (int)(element_count + i);
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+    bool result = red_black_properties(tree.root, 0, 0) && black_height(tree.root) >= 0 &&
+        std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin(), tree.end());
+    tree.clear();
+    return result;
+}
+
+bool test_header(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int, std::allocator<int>, OrderStatistics> tree;
+
+    // Priority queue: cached min and max must follow inserts and pops
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % 1000;
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+        if (i % 3 == 0) {
+            reference_multiset.erase(reference_multiset.begin());
+            tree.pop_min();
+        }
+        else if (i % 3 == 1) {
+            reference_multiset.erase(std::prev(reference_multiset.end()));
+            tree.pop_max();
+        }
+        if (!reference_multiset.empty() && (*tree.begin() != *reference_multiset.begin() || *std::prev(tree.end()) != *reference_multiset.rbegin())) {
+            return false;
+        }
+    }
+    if (!red_black_properties(tree.root, 0, 0) || tree.size() != reference_multiset.size()) {
+        return false;
+    }
+
+    // Copies are independent, moves leave the source empty
+    RedBlackTree<int, std::allocator<int>, OrderStatistics> copy(tree);
+    copy.pop_min();
+    if (!std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin()) || copy.size() + 1 != tree.size()) {
+        return false;
+    }
+    RedBlackTree<int, std::allocator<int>, OrderStatistics> moved(std::move(copy));
+    if (!copy.empty() || copy.begin() != copy.end() || !std::equal(std::next(reference_multiset.begin()), reference_multiset.end(), moved.begin())) {
+        return false;
+    }
+    copy = tree;
+    moved = std::move(copy);
+    if (!red_black_properties(moved.root, 0, 0) || !std::equal(reference_multiset.begin(), reference_multiset.end(), moved.begin())) {
+        return false;
+    }
+    if (*--moved.end() != *reference_multiset.rbegin()) {
+        return false;
+    }
+
+    // Emptying the tree makes begin() == end()
+    while (!tree.empty()) {
+        tree.pop_max();
+    }
+    moved.clear();
+    return tree.begin() == tree.end() && tree.max() == tree.end() && moved.begin() == moved.end();
+}
+
+template <typename Tree>
+bool test_layout(size_t element_count)
+{
+    std::multiset<typename Tree::value_type> reference_multiset;
+    Tree tree;
+
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        typename Tree::value_type value = rand() % 1000;
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+        if (i % 3 == 0) {
+            value = rand() % 1000;
+            if (reference_multiset.find(value) != reference_multiset.end()) {
+                reference_multiset.erase(reference_multiset.find(value));
+            }
+            tree.erase(value);
+        }
+    }
+    if (!red_black_properties(tree.root, 0, 0) || !std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin())) {
+        return false;
+    }
+    if (*--tree.end() != *reference_multiset.rbegin() || tree.find(*reference_multiset.begin()) == NULL) {
+        return false;
+    }
+
+    // Relinking operations move nodes between trees
+    std::pair<Tree, Tree> halves = tree.split(500);
+    halves.first.join(std::move(halves.second));
+    Tree copy(halves.first);
+    halves.first.set_union(std::move(copy));
+    if (!red_black_properties(halves.first.root, 0, 0) || !std::equal(reference_multiset.begin(), reference_multiset.end(), halves.first.begin())) {
+        return false;
+    }
+    halves.first.clear();
+    return tree.empty();
+}
+
+bool test_compact_layouts(size_t element_count)
+{
+    if (sizeof(RedBlackNode<long long, CompactColor>) >= sizeof(RedBlackNode<long long>)) {
+        return false;
+    }
+    if (sizeof(RedBlackNode<int, IndexLinks>) != sizeof(int) + 3 * sizeof(uint32_t)) {
+        return false;
+    }
+    if (!test_layout<RedBlackTree<long long, std::allocator<long long>, CompactColor> >(element_count)) {
+        return false;
+    }
+    if (!test_layout<RedBlackTree<int, std::allocator<int>, IndexLinks> >(element_count)) {
+        return false;
+    }
+
+    // Layouts combine with other augmentations
+    typedef RedBlackTree<int, std::allocator<int>, Augments<IndexLinks, OrderStatistics> > rankedType;
+    bool result;
+    {
+        rankedType ranked;
+        for (int i = 0; i < (int)element_count; i++)
+        {
+            ranked.insert(i);
+        }
+        result = red_black_properties(ranked.root, 0, 0) && ranked.size() == element_count && *ranked.select(element_count / 2) == (int)element_count / 2;
+    }
+
+    // Trees in different threads share the arena of their node type
+    typedef RedBlackTree<int, std::allocator<int>, IndexLinks> indexType;
+    std::vector<std::future<bool> > builders;
+    for (int thread = 0; thread < 4; thread++)
+    {
+        builders.push_back(std::async(std::launch::async, [thread, element_count]() {
+            indexType tree;
+            for (size_t i = 0; i < element_count; i++)
+            {
+                tree.insert((int)(i * 4 + thread));
+                if (i % 3 == 0) {
+                    tree.erase((int)(i * 4 + thread));
+                }
+            }
+            return red_black_properties(tree.root, 0, 0) && tree.find(thread) == NULL && tree.find(4 + thread) != NULL;
+        }));
+    }
+    for (size_t i = 0; i < builders.size(); i++)
+    {
+        result = builders[i].get() && result;
+    }
+
+    // With all trees gone, the arenas give their memory back
+    if (!RedBlackIndexArena<indexType::nodeType>::shrink() || RedBlackIndexArena<indexType::nodeType>::reserved_bytes() != 0) {
+        return false;
+    }
+    return result && RedBlackIndexArena<rankedType::nodeType>::shrink();
+}
+
+bool test_frozen(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int> tree;
+
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % 1000;
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+
+    FrozenRedBlackTree<int> frozen = tree.freeze();
+    if (frozen.size() != element_count) {
+        return false;
+    }
+    std::vector<int> visited;
+    frozen.for_each([&visited](int value) { visited.push_back(value); });
+    if (!std::equal(reference_multiset.begin(), reference_multiset.end(), visited.begin(), visited.end())) {
+        return false;
+    }
+
+    for (int key = -5; key < 1005; key++)
+    {
+        // Bounds point to the first of equal values, which follows the last smaller value in order
+        std::multiset<int>::iterator lower = reference_multiset.lower_bound(key);
+        std::multiset<int>::iterator upper = reference_multiset.upper_bound(key);
+        const int* frozenLower = frozen.lower_bound(key);
+        const int* frozenUpper = frozen.upper_bound(key);
+        if ((lower == reference_multiset.end()) != (frozenLower == NULL) || (frozenLower != NULL && *frozenLower != *lower)) {
+            return false;
+        }
+        if ((upper == reference_multiset.end()) != (frozenUpper == NULL) || (frozenUpper != NULL && *frozenUpper != *upper)) {
+            return false;
+        }
+        if ((frozen.find(key) != NULL) != (reference_multiset.count(key) != 0)) {
+            return false;
+        }
+        if (lower != reference_multiset.end() && frozenLower != frozen.find(key) && *lower == key) {
+            return false;
+        }
+    }
+
+    // Floating-point keys, a comparator and copies
+    RedBlackTree<double, std::allocator<double>, NoAugment, std::greater<double> > doubles;
+    for (int i = 0; i < 100; i++)
+    {
+        doubles.insert(i * 0.5);
+    }
+    FrozenRedBlackTree<double, std::greater<double> > frozenDoubles = doubles.freeze();
+    FrozenRedBlackTree<double, std::greater<double> > copy = frozenDoubles;
+    frozenDoubles = FrozenRedBlackTree<double, std::greater<double> >();
+    if (!frozenDoubles.empty() || frozenDoubles.lower_bound(1.0) != NULL || copy.find(10.5) == NULL || copy.find(10.25) != NULL) {
+        return false;
+    }
+    if (*copy.lower_bound(10.25) != 10.0 || *copy.upper_bound(10.0) != 9.5 || copy.lower_bound(-1.0) != NULL || *copy.lower_bound(100.0) != 49.5) {
+        return false;
+    }
+
+    // Three-way comparators and heterogeneous keys
+    RedBlackTree<std::string, std::allocator<std::string>, NoAugment, ThreeWayCompare> strings;
+    strings.insert("apple");
+    strings.insert("banana");
+    strings.insert("cherry");
+    FrozenRedBlackTree<std::string, ThreeWayCompare> frozenStrings = strings.freeze();
+    if (frozenStrings.find(std::string_view("banana")) == NULL || *frozenStrings.lower_bound(std::string_view("b")) != "banana" || frozenStrings.upper_bound(std::string_view("cherry")) != NULL) {
+        return false;
+    }
+
+    tree.clear();
+    strings.clear();
+    doubles.clear();
+    return true;
+}
+
+bool test_find_batch(size_t element_count)
+{
+    RedBlackTree<int> tree;
+    std::vector<int> keys;
+
+    // Batched results must match single lookups, for empty trees and for batches that are not multiples of the group size
+    std::vector<RedBlackTree<int>::nodeType*> found(3);
+    std::vector<RedBlackTree<int>::iterator> bounds;
+    keys.push_back(1);
+    keys.push_back(2);
+    keys.push_back(3);
+    if (tree.find_batch(keys.begin(), keys.end(), found.begin()) != found.end() || found[0] != NULL || found[2] != NULL) {
+        return false;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        tree.insert(rand() % 1000);
+    }
+    keys.clear();
+    for (int key = -5; key < 1010; key++)
+    {
+        keys.push_back(key);
+    }
+    for (size_t i = 1; i < keys.size(); i++)
+    {
+        std::swap(keys[i], keys[rand() % (i + 1)]);
+    }
+
+    found.clear();
+    tree.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+    tree.lower_bound_batch(keys.begin(), keys.end(), std::back_inserter(bounds));
+    if (found.size() != keys.size() || bounds.size() != keys.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if ((found[i] == NULL) != (tree.find(keys[i]) == NULL) || (found[i] != NULL && found[i]->value != keys[i])) {
+            return false;
+        }
+        if (bounds[i] != tree.lower_bound(keys[i])) {
+            return false;
+        }
+    }
+
+    tree.clear();
+    return true;
+}
+
+template <typename T>
+int persistent_black_height(PersistentRedBlackNode<T>* node)
+{
+    // Returns black height of a valid subtree, -1 if the subtree breaks a red-black property
+    if (node == NULL) {
+        return 1;
+    }
+    if (node->color == RED && ((node->left != NULL && node->left->color == RED) || (node->right != NULL && node->right->color == RED))) {
+        return -1;
+    }
+    int left = persistent_black_height(node->left);
+    int right = persistent_black_height(node->right);
+    if (left < 0 || left != right) {
+        return -1;
+    }
+    return left + (node->color == BLACK ? 1 : 0);
+}
+
+template <typename Tree>
+bool persistent_equal(const Tree& tree, const std::multiset<int>& reference)
+{
+    std::vector<int> visited;
+    tree.for_each([&visited](int value) { visited.push_back(value); });
+    return tree.size() == reference.size() && std::equal(reference.begin(), reference.end(), visited.begin(), visited.end());
+}
+
+bool test_persistent(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    PersistentRedBlackTree<int> tree;
+    std::vector<PersistentRedBlackTree<int> > snapshots;
+    std::vector<std::multiset<int> > snapshot_contents;
+
+    // Snapshots keep their content while the tree keeps changing
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % 1000;
+        if (rand() % 3 == 0) {
+            bool present = reference_multiset.count(value) != 0;
+            if (present) {
+                reference_multiset.erase(reference_multiset.find(value));
+            }
+            if (tree.erase(value) != (present ? 1 : 0)) {
+                return false;
+            }
+        }
+        else {
+            reference_multiset.insert(value);
+            tree.insert(value);
+        }
+        if (tree.root != NULL && (tree.root->color != BLACK || persistent_black_height(tree.root) < 0)) {
+            return false;
+        }
+        if (i % 97 == 0) {
+            snapshots.push_back(tree.snapshot());
+            snapshot_contents.push_back(reference_multiset);
+        }
+    }
+
+    if (!persistent_equal(tree, reference_multiset)) {
+        return false;
+    }
+    for (size_t i = 0; i < snapshots.size(); i++)
+    {
+        if (!persistent_equal(snapshots[i], snapshot_contents[i]) || (snapshots[i].root != NULL && persistent_black_height(snapshots[i].root) < 0)) {
+            return false;
+        }
+    }
+
+    for (int key = -5; key < 1005; key++)
+    {
+        std::multiset<int>::iterator lower = reference_multiset.lower_bound(key);
+        const int* found = tree.lower_bound(key);
+        if ((lower == reference_multiset.end()) != (found == NULL) || (found != NULL && *found != *lower)) {
+            return false;
+        }
+        if ((tree.find(key) != NULL) != (reference_multiset.count(key) != 0)) {
+            return false;
+        }
+    }
+
+    // Erase everything from an old snapshot, the others stay unchanged
+    PersistentRedBlackTree<int> old = snapshots[snapshots.size() / 2];
+    std::multiset<int> old_content = snapshot_contents[snapshots.size() / 2];
+    for (int value : old_content)
+    {
+        if (old.erase(value) != 1) {
+            return false;
+        }
+    }
+    if (!old.empty() || !persistent_equal(snapshots[snapshots.size() / 2], old_content) || !persistent_equal(tree, reference_multiset)) {
+        return false;
+    }
+
+    // Readers in other threads use their snapshots while the writer goes on
+    std::vector<std::future<bool> > readers;
+    for (size_t i = 0; i < 4; i++)
+    {
+        PersistentRedBlackTree<int> snapshot = tree.snapshot();
+        std::multiset<int> content = reference_multiset;
+        readers.push_back(std::async(std::launch::async, [snapshot, content]() { return persistent_equal(snapshot, content); }));
+        for (size_t j = 0; j < 200; j++)
+        {
+            int value = rand() % 1000;
+            tree.insert(value);
+            reference_multiset.insert(value);
+            if (tree.erase(value + 1) == 1) {
+                reference_multiset.erase(reference_multiset.find(value + 1));
+            }
+        }
+    }
+    for (size_t i = 0; i < readers.size(); i++)
+    {
+        if (!readers[i].get()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool test_sharded(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    ShardedRedBlackTree<int> tree(8, 64);
+
+    srand(42);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % 100000;
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+    for (size_t i = 0; i < element_count / 4; i++)
+    {
+        int value = rand() % 100000;
+        if (reference_multiset.count(value) != 0) {
+            reference_multiset.erase(reference_multiset.find(value));
+        }
+        tree.erase(value);
+    }
+    if (tree.size() != reference_multiset.size() || !std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin(), tree.end())) {
+        return false;
+    }
+    for (int value = 0; value < 1000; value++)
+    {
+        if (tree.contains(value) != (reference_multiset.count(value) != 0)) {
+            return false;
+        }
+    }
+
+    // Increasing values always hit the last shard, the boundaries have to follow them
+    ShardedRedBlackTree<int> growing(8, 64);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        growing.insert((int)i);
+    }
+    std::vector<int> visited;
+    growing.for_each([&visited](int value) { visited.push_back(value); });
+    if (visited.size() != element_count || !std::is_sorted(visited.begin(), visited.end()) || visited.back() != (int)element_count - 1) {
+        return false;
+    }
+    for (size_t i = 0; i < growing.shard_count(); i++)
+    {
+        if (growing.shard_size(i) == 0 || growing.shard_size(i) > element_count / 2) {
+            return false;
+        }
+    }
+
+    // Writers in parallel, every thread inserts its own values
+    ShardedRedBlackTree<int> shared(8, 64);
+    std::vector<std::future<void> > writers;
+    for (int thread = 0; thread < 4; thread++)
+    {
+        writers.push_back(std::async(std::launch::async, [&shared, thread, element_count]() {
+            for (size_t i = 0; i < element_count; i++)
+            {
+                shared.insert((int)(i * 4 + thread));
+                if (i % 3 == 0) {
+                    shared.erase((int)(i * 4 + thread));
+                }
+            }
+        }));
+    }
+    for (size_t i = 0; i < writers.size(); i++)
+    {
+        writers[i].get();
+    }
+    size_t expected = 0;
+    for (ShardedRedBlackTree<int>::const_iterator it = shared.begin(); it != shared.end(); ++it)
+    {
+        // Value i * 4 + thread was erased again when i % 3 == 0
+        while ((expected / 4) % 3 == 0) {
+            expected++;
+        }
+        if (*it != (int)expected) {
+            return false;
+        }
+        expected++;
+    }
+    if (shared.size() != 4 * (element_count - (element_count + 2) / 3)) {
+        return false;
+    }
+
+    tree.clear();
+    growing.clear();
+    shared.clear();
+    return tree.empty();
+}
+
+bool test_batches(size_t element_count, size_t grain)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int, std::allocator<int>, OrderStatistics> tree;
+
+    srand(11);
+    for (size_t round = 0; round < 6; round++)
+    {
+        // Batches of growing size with duplicates inside the batch and against the tree
+        std::vector<int> batch;
+        for (size_t i = 0; i < (element_count << round) / 32; i++)
+        {
+            batch.push_back(rand() % (int)element_count);
+        }
+        reference_multiset.insert(batch.begin(), batch.end());
+        tree.insert_batch(batch.begin(), batch.end(), grain);
+        if (!red_black_properties(tree.root, 0, 0) || tree.size() != reference_multiset.size()) {
+            return false;
+        }
+        if (!std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin(), tree.end())) {
+            return false;
+        }
+    }
+
+    std::vector<int> erased;
+    for (size_t i = 0; i < element_count / 2; i++)
+    {
+        int value = rand() % (int)element_count;
+        erased.push_back(value);
+        reference_multiset.erase(value);
+    }
+    // Keys below the minimum and past the maximum are searched from the previous key as well
+    erased.push_back(-5);
+    erased.push_back((int)element_count + 5);
+    tree.erase_batch(erased.begin(), erased.end(), grain);
+    if (!red_black_properties(tree.root, 0, 0) || black_height(tree.root) < 0 || tree.size() != reference_multiset.size()) {
+        return false;
+    }
+    if (!std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin(), tree.end()) || (tree.begin() != tree.end() && *--tree.end() != *reference_multiset.rbegin())) {
+        return false;
+    }
+
+    tree.erase_batch(erased.begin(), erased.begin());
+    tree.insert_batch(erased.begin(), erased.begin());
+    bool result = tree.size() == reference_multiset.size();
+    tree.clear();
+    return result;
+}
+
+bool test_build_parallel(size_t element_count)
+{
+    std::vector<int> values;
+    srand(3);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        values.push_back(rand() % (int)element_count);
+    }
+    std::vector<int> sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+
+    // The shape must not depend on the number of threads
+    for (unsigned threads = 1; threads <= 8; threads *= 2)
+    {
+        RedBlackTree<int, std::allocator<int>, OrderStatistics> tree;
+        tree.insert(-1);
+        tree.build_parallel(values.begin(), values.end(), threads);
+        if (!red_black_properties(tree.root, 0, 0) || tree.size() != element_count) {
+            return false;
+        }
+        if (!std::equal(sorted.begin(), sorted.end(), tree.begin(), tree.end()) || *--tree.end() != sorted.back()) {
+            return false;
+        }
+        if (*tree.select(element_count / 3) != sorted[element_count / 3]) {
+            return false;
+        }
+        tree.clear();
+    }
+
+    // Nodes from a pool are built in one thread
+    RedBlackNodePool<int> pool;
+    RedBlackTree<int, RedBlackNodePool<int> > pooled(pool);
+    pooled.build_parallel(values.begin(), values.end(), 4);
+    bool result = red_black_properties(pooled.root, 0, 0) && std::equal(sorted.begin(), sorted.end(), pooled.begin(), pooled.end());
+    pooled.clear();
+    return result;
+}
+
+bool test_ownership(size_t element_count)
+{
+    // One allocation per node, copies clone nodes, moves and destruction allocate nothing
+    size_t live = live_allocations.load();
+    size_t allocations = allocation_count.load();
+    {
+        RedBlackTree<int> tree;
+        for (size_t i = 0; i < element_count; i++)
+        {
+            tree.insert((int)((i * 7919) % element_count));
+        }
+        if (allocation_count.load() - allocations != element_count) {
+            return false;
+        }
+
+        allocations = allocation_count.load();
+        RedBlackTree<int> copy(tree);
+        if (allocation_count.load() - allocations != element_count || !red_black_properties(copy.root, 0, 0)) {
+            return false;
+        }
+        if (!std::equal(tree.begin(), tree.end(), copy.begin(), copy.end())) {
+            return false;
+        }
+        copy.erase(0);
+        if (tree.find(0) == NULL || copy.find(0) != NULL) {
+            return false;
+        }
+
+        allocations = allocation_count.load();
+        RedBlackTree<int> moved(std::move(copy));
+        copy = std::move(moved);
+        moved = copy;
+        moved = RedBlackTree<int>();
+        for (size_t i = 0; i < element_count; i++)
+        {
+            tree.erase((int)i);
+        }
+        if (allocation_count.load() - allocations != element_count - 1 || !tree.empty() || !moved.empty() || copy.find(1) == NULL) {
+            return false;
+        }
+    }
+    if (live_allocations.load() != live) {
+        return false;
+    }
+
+    // Sorted inserts and a merge with a copy of the other tree
+    {
+        RedBlackTree<int> tree1, tree2;
+        for (size_t i = 0; i < element_count; i++)
+        {
+            tree1.insert((int)i);
+            tree2.insert((int)(i + element_count));
+        }
+        tree1.merge(tree2);
+        if (tree2.empty() || !red_black_properties(tree1.root, 0, 0) || (size_t)std::distance(tree1.begin(), tree1.end()) != 2 * element_count) {
+            return false;
+        }
+    }
+    if (live_allocations.load() != live) {
+        return false;
+    }
+
+    // Moves can't throw, so a growing vector moves its trees instead of copying their nodes
+    if (!std::is_nothrow_move_constructible<RedBlackTree<int>>::value || !std::is_nothrow_move_assignable<RedBlackTree<int>>::value ||
+        !std::is_nothrow_move_assignable<RedBlackTree<int, RedBlackNodePool<int>>>::value) {
+        return false;
+    }
+    {
+        std::vector<RedBlackTree<int>> trees(1);
+        for (size_t i = 0; i < element_count; i++)
+        {
+            trees[0].insert((int)i);
+        }
+        allocations = allocation_count.load();
+        trees.reserve(16);
+        if (allocation_count.load() - allocations != 1 || (size_t)std::distance(trees[0].begin(), trees[0].end()) != element_count) {
+            return false;
+        }
+    }
+
+    // The pool follows the nodes on move assignment, nodes keep their addresses
+    {
+        RedBlackNodePool<int> pool1, pool2;
+        RedBlackTree<int, RedBlackNodePool<int>> tree1(pool1), tree2(pool2);
+        for (size_t i = 0; i < element_count; i++)
+        {
+            tree1.insert((int)i);
+        }
+        const int* first = &*tree1.begin();
+        tree2 = std::move(tree1);
+        if (&*tree2.begin() != first || tree2.get_allocator() != pool1 || !tree1.empty() || !red_black_properties(tree2.root, 0, 0)) {
+            return false;
+        }
+        tree1.insert(1);
+        if ((size_t)std::distance(tree2.begin(), tree2.end()) != element_count || tree1.find(1) == NULL) {
+            return false;
+        }
+    }
+    return live_allocations.load() == live;
+}
+
+bool test_stats(size_t element_count)
+{
+    // Instrumented adds nothing to nodes, other trees report only their shape
+    if (sizeof(RedBlackNode<int, Instrumented>) != sizeof(RedBlackNode<int>)) {
+        return false;
+    }
+    RedBlackTree<int> plain;
+    plain.insert(1);
+    if (plain.stats().comparisons != 0 || plain.stats().allocations != 0 || plain.stats().height != 1) {
+        return false;
+    }
+
+    RedBlackTree<int, std::allocator<int>, Instrumented> tree;
+    srand(5);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        tree.insert(rand() % (int)element_count);
+    }
+    for (size_t i = 0; i < element_count; i++)
+    {
+        tree.find((int)i);
+    }
+    for (size_t i = 0; i < element_count / 2; i++)
+    {
+        tree.erase(*tree.begin());
+    }
+
+    RedBlackStats stats = tree.stats();
+    if (stats.allocations != element_count || stats.deallocations != element_count / 2 || stats.left_rotations == 0 || stats.right_rotations == 0 || stats.recolors == 0) {
+        return false;
+    }
+    if (stats.operations[FIND_OPERATION] != element_count || stats.operations[INSERT_OPERATION] != element_count || stats.operations[ERASE_OPERATION] != element_count / 2) {
+        return false;
+    }
+    for (int operation = 0; operation < RedBlackStats::operationCount; operation++)
+    {
+        size_t timed = 0;
+        for (int bucket = 0; bucket < RedBlackStats::latencyBuckets; bucket++)
+        {
+            timed += stats.latency[operation][bucket];
+        }
+        if (timed != (stats.operations[operation] + RedBlackStats::latencySampling - 1) / RedBlackStats::latencySampling) {
+            return false;
+        }
+    }
+
+    // The height is at most 2 log(n + 1), a find compares once per level and once more at the end
+    size_t remaining = element_count - element_count / 2;
+    int bits = 0;
+    while ((size_t(1) << bits) <= element_count) {
+        bits++;
+    }
+    int max_height = 2 * bits;
+    if (stats.height > max_height || stats.black_height < (stats.height + 1) / 2 || stats.operation_comparisons[FIND_OPERATION] > element_count * (2 * max_height + 1)) {
+        return false;
+    }
+    if (stats.comparisons < stats.operation_comparisons[FIND_OPERATION] + stats.operation_comparisons[INSERT_OPERATION] + stats.operation_comparisons[ERASE_OPERATION]) {
+        return false;
+    }
+
+    std::string json = stats.to_json();
+    if (json.find("\"left_rotations\":" + std::to_string(stats.left_rotations)) == std::string::npos || json.find("\"find\":{\"count\":" + std::to_string(element_count)) == std::string::npos || json.back() != '}') {
+        return false;
+    }
+
+    tree.reset_stats();
+    tree.clear();
+    stats = tree.stats();
+    if (stats.comparisons != 0 || stats.deallocations != remaining || stats.height != 0 || stats.black_height != 0) {
+        return false;
+    }
+
+    // Parallel algorithms of an instrumented tree run in one thread, so the counters don't race (see REDBLACKTREE_SANITIZE_THREAD)
+    std::vector<int> values(element_count * 10);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        values[i] = rand();
+    }
+    tree.build_parallel(values.begin(), values.end(), 4);
+    RedBlackTree<int, std::allocator<int>, Instrumented> other;
+    std::vector<int> sorted_values(values.begin(), values.begin() + element_count);
+    std::sort(sorted_values.begin(), sorted_values.end());
+    other.assign(sorted_values.begin(), sorted_values.end());
+    tree.reset_stats();
+    tree.set_union(std::move(other), 64);
+    std::sort(values.begin(), values.end());
+    return tree.stats().comparisons != 0 && other.empty() && red_black_properties(tree.root, 0, 0) && std::equal(values.begin(), values.end(), tree.begin(), tree.end());
+}
+
+template <typename T, typename Compare>
+int mapped_black_height(const MappedRedBlackTree<T, Compare>& mapped, const RedBlackImageNode<T>* node)
+{
+    // Black height of the saved subtree, -1 if a red node has a red child or the black heights differ
+    if (node == NULL) {
+        return 0;
+    }
+    const RedBlackImageNode<T>* left = mapped.node(node->left);
+    const RedBlackImageNode<T>* right = mapped.node(node->rightLink());
+    if (node->getColor() == RED && ((left != NULL && left->getColor() == RED) || (right != NULL && right->getColor() == RED))) {
+        return -1;
+    }
+    int left_height = mapped_black_height(mapped, left);
+    int right_height = mapped_black_height(mapped, right);
+    if (left_height < 0 || left_height != right_height) {
+        return -1;
+    }
+    return left_height + (node->getColor() == BLACK);
+}
+
+bool test_mapped(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int> tree;
+    const std::string path = "test_mapped.image";
+
+    srand(23);
+    for (size_t i = 0; i < element_count; i++)
+    {
+        int value = rand() % 1000;
+
+        reference_multiset.insert(value);
+        tree.insert(value);
+    }
+    if (!tree.save(path)) {
+        return false;
+    }
+
+    {
+        // The saved shape and colours are served from the mapping
+        MappedRedBlackTree<int> mapped = RedBlackTree<int>::load_mapped(path);
+        if (mapped.size() != element_count || mapped_black_height(mapped, mapped.root_node()) <= 0) {
+            return false;
+        }
+        if (!std::equal(reference_multiset.begin(), reference_multiset.end(), mapped.begin(), mapped.end())) {
+            return false;
+        }
+        for (int key = -5; key < 1005; key++)
+        {
+            std::multiset<int>::iterator lower = reference_multiset.lower_bound(key);
+            std::multiset<int>::iterator upper = reference_multiset.upper_bound(key);
+            const int* mappedLower = mapped.lower_bound(key);
+            const int* mappedUpper = mapped.upper_bound(key);
+            if ((lower == reference_multiset.end()) != (mappedLower == NULL) || (mappedLower != NULL && *mappedLower != *lower)) {
+                return false;
+            }
+            if ((upper == reference_multiset.end()) != (mappedUpper == NULL) || (mappedUpper != NULL && *mappedUpper != *upper)) {
+                return false;
+            }
+            if ((mapped.find(key) != NULL) != (reference_multiset.count(key) != 0)) {
+                return false;
+            }
+        }
+
+        // A mapped image is a sorted range, so it can be thawed into a tree in O(n)
+        RedBlackTree<int> thawed(mapped.begin(), mapped.end());
+        if (!red_black_properties(thawed.root, 0, 0) || !std::equal(thawed.begin(), thawed.end(), tree.begin(), tree.end())) {
+            return false;
+        }
+    }
+
+    // Damaged images are rejected, without the check they still load
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (file == NULL) {
+        return false;
+    }
+    fseek(file, 64 + 3, SEEK_SET);
+    fputc(0x7f, file);
+    fclose(file);
+    if (!RedBlackTree<int>::load_mapped(path).empty() || RedBlackTree<int>::load_mapped(path, false).size() != element_count) {
+        return false;
+    }
+    if (!MappedRedBlackTree<long long>(path).empty()) {
+        return false;
+    }
+
+    // A crafted image with a valid checksum but a link back to the root (a search would loop) is rejected too
+    if (!tree.save(path)) {
+        return false;
+    }
+    std::vector<char> image;
+    file = fopen(path.c_str(), "rb");
+    for (int c = (file != NULL) ? fgetc(file) : EOF; c != EOF; c = fgetc(file))
+    {
+        image.push_back((char)c);
+    }
+    if (file == NULL || image.size() != sizeof(RedBlackImageHeader) + element_count * sizeof(RedBlackImageNode<int>)) {
+        return false;
+    }
+    fclose(file);
+    RedBlackImageHeader header;
+    memcpy(&header, image.data(), sizeof(header));
+    RedBlackImageNode<int>* image_nodes = reinterpret_cast<RedBlackImageNode<int>*>(image.data() + sizeof(header));
+    image_nodes[header.root - 1].left = header.root;
+    header.checksum = redBlackImageChecksum(image_nodes, element_count * sizeof(RedBlackImageNode<int>));
+    memcpy(image.data(), &header, sizeof(header));
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL || fwrite(image.data(), 1, image.size(), file) != image.size()) {
+        return false;
+    }
+    fclose(file);
+    if (!RedBlackTree<int>::load_mapped(path).empty()) {
+        return false;
+    }
+
+    // Empty trees and other value types and comparators
+    RedBlackTree<int> empty_tree;
+    if (!empty_tree.save(path) || !RedBlackTree<int>::load_mapped(path).empty()) {
+        return false;
+    }
+    RedBlackTree<double, std::allocator<double>, NoAugment, std::greater<double> > doubles;
+    for (size_t i = 0; i < element_count; i++)
+    {
+        doubles.insert(i * 0.5);
+    }
+    bool result = doubles.save(path);
+    {
+        MappedRedBlackTree<double, std::greater<double> > mapped(path);
+        const double* found = mapped.lower_bound(10.25);
+        result = result && mapped.size() == element_count && *mapped.begin() == (element_count - 1) * 0.5 && found != NULL && *found == 10.0;
+    }
+    std::remove(path.c_str());
+    return result;
+}
+
+size_t pool_destroy_count = 0;
+
+template <typename T>
+struct CountingPool : public RedBlackNodePool<T> {
+    // Node pool that counts destroy calls, so we can see whether clear() visits the nodes
+    template <typename U>
+    struct rebind {
+        typedef CountingPool<U> other;
+    };
+
+    CountingPool() {}
+
+    template <typename U>
+    CountingPool(const CountingPool<U>& that) : RedBlackNodePool<T>(that) {}
+
+    template <typename U>
+    void destroy(U* ptr) {
+        pool_destroy_count++;
+        ptr->~U();
+    }
+};
+
+bool test_node_pool(size_t element_count)
+{
+    std::multiset<int> reference_multiset;
+    RedBlackTree<int, RedBlackNodePool<int> > tree;
+
+    srand(42);
+    for (size_t round = 0; round < 2; round++)
+    {
+        for (size_t i = 0; i < element_count; i++)
+        {
+            int value = rand() % 1000;
+
+            reference_multiset.insert(value);
+            tree.insert(value);
+        }
+
+        for (size_t i = 0; i < element_count / 2; i++)
+        {
+            int value = rand() % 1000;
+
+            if (reference_multiset.find(value) != reference_multiset.end()) {
+                reference_multiset.erase(reference_multiset.find(value));
+            }
+            tree.erase(value);
+        }
+
+        if (!red_black_properties(tree.root, 0, 0) || !std::equal(reference_multiset.begin(), reference_multiset.end(), tree.begin(), tree.end())) {
+            return false;
+        }
+
+        // Release all nodes at once and reuse the slabs in the next round
+        tree.clear();
+        reference_multiset.clear();
+        if (!tree.empty()) {
+            return false;
+        }
+    }
+
+    // Slabs hold at least one node, even if the pool asks for none
+    RedBlackTree<int, RedBlackNodePool<int> > tiny((RedBlackNodePool<int>(0)));
+    for (int i = 0; i < 100; i++)
+    {
+        tiny.insert(i);
+    }
+    if (!red_black_properties(tiny.root, 0, 0) || tiny.find(99) == NULL) {
+        return false;
+    }
+
+    // Trivially destructible values are released without visiting the nodes
+    RedBlackTree<int, CountingPool<int> > counted;
+    for (size_t i = 0; i < element_count; i++)
+    {
+        counted.insert((int)i);
+    }
+    pool_destroy_count = 0;
+    counted.clear();
+    return pool_destroy_count == 0 && counted.empty();
+}
+
+bool run_tests()
+{
+
+    bool currentTestOk;
+    bool allTestsOk = true;
+
+    std::cout << "Small multiple insert test:\t";
+    currentTestOk = test_multi_insert(100);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Large multiple insert test:\t";
+    currentTestOk = test_multi_insert(10000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Erase test:\t";
+    currentTestOk = test_multi_erase(100, 30);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Small merge test:\t";
+    currentTestOk = test_multi_merge(50, 100);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Large merge test:\t";
+    currentTestOk = test_multi_merge(400, 500);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Join test:\t";
+    currentTestOk = test_join(10, 1000) && test_join(1000, 10) && test_join(300, 300);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Split test:\t";
+    currentTestOk = test_split(1000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Set operations test:\t";
+    currentTestOk = test_set_operations(1000, 4096) && test_set_operations(5000, 16);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Order statistics test:\t";
+    currentTestOk = test_order_statistics(2000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Aggregate test:\t";
+    currentTestOk = test_aggregate(2000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Interval tree test:\t";
+    currentTestOk = test_interval_tree(2000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Find test:\t";
+    currentTestOk = test_multi_find(300);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Bounds test:\t";
+    currentTestOk = test_bounds(1000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Comparators test:\t";
+    currentTestOk = test_comparators();
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Map test:\t";
+    currentTestOk = test_map(2000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Erase by iterator test:\t";
+    currentTestOk = test_erase_iterators(5000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Min/max test:\t";
+    currentTestOk = test_min_max(300);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Iterators test:\t";
+    currentTestOk = test_iterators(300);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "For each test:\t";
+    currentTestOk = test_for_each(2000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Sorted construction test:\t";
+    currentTestOk = test_sorted_construction(1000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Hinted insert test:\t";
+    currentTestOk = test_hinted_insert(2000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Header test:\t";
+    currentTestOk = test_header(3000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Compact layouts test:\t";
+    currentTestOk = test_compact_layouts(3000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Frozen tree test:\t";
+    currentTestOk = test_frozen(3000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Batched lookup test:\t";
+    currentTestOk = test_find_batch(3000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Persistent tree test:\t";
+    currentTestOk = test_persistent(5000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Sharded tree test:\t";
+    currentTestOk = test_sharded(5000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Batch insert/erase test:\t";
+    currentTestOk = test_batches(4000, (size_t)-1) && test_batches(4000, 64) && test_batches(4000, 1);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Parallel construction test:\t";
+    currentTestOk = test_build_parallel(100000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Ownership test:\t";
+    currentTestOk = test_ownership(5000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Statistics test:\t";
+    currentTestOk = test_stats(5000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Mapped image test:\t";
+    currentTestOk = test_mapped(5000);
+    allTestsOk = allTestsOk && currentTestOk;
+    std::cout << (currentTestOk ? "OK" : "ERROR");
+    std::cout << std::endl;
+
+    std::cout << "Node pool test:\t";
+    currentTestOk = test_node_pool(1000);
+    allTestsOk = allTestsOk && currentTestOk;
     std::cout << (currentTestOk ? "OK" : "ERROR");
     std::cout << std::endl;
 
@@ -321,17 +2210,14 @@ bool run_tests()
 }
 
 int main() {
+    size_t allocations_before = live_allocations.load();
     bool allOk = run_tests();
 
 
-    // Check for memory leaks (display them in standard output)
-    _CrtSetReportMode(_CRT_WARN, _CRTDBG_MODE_FILE);
-    _CrtSetReportFile(_CRT_WARN, _CRTDBG_FILE_STDOUT);
-    _CrtSetReportMode(_CRT_ERROR, _CRTDBG_MODE_FILE);
-    _CrtSetReportFile(_CRT_ERROR, _CRTDBG_FILE_STDOUT);
-    _CrtSetReportMode(_CRT_ASSERT, _CRTDBG_MODE_FILE);
-    _CrtSetReportFile(_CRT_ASSERT, _CRTDBG_FILE_STDOUT);
-    _CrtDumpMemoryLeaks();
+    // Check for memory leaks (everything allocated by the tests must be freed again)
+    size_t leaks = live_allocations.load() - allocations_before;
+    std::cout << "Allocations: " << allocation_count.load() << "\tleaked: " << leaks << std::endl;
+    allOk = allOk && leaks == 0;
 
     // Propagate the information about failed tests outside (e.g. for CI/CD scenarios)
     return allOk ? 0 : -1;